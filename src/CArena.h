@@ -0,0 +1,82 @@
+#ifndef CArena_H
+#define CArena_H
+
+#include <vector>
+#include <memory>
+#include <cassert>
+
+// arena of items of type T allocated in fixed size blocks
+//
+// items keep their address while in the arena and are indexed in the order they were
+// added. Only the last item can be removed (pop) and clear removes all items at once.
+// Blocks are kept when items are removed so a cleared arena is refilled without any
+// further allocation.
+//
+// T must be default constructible and copy assignable
+//
+template<typename T, uint BLOCK_SIZE=1024>
+class CArena {
+ public:
+  CArena() { }
+
+  CArena(const CArena &) = delete;
+  CArena &operator=(const CArena &) = delete;
+
+  // get number of items
+  uint size() const { return size_; }
+
+  bool empty() const { return size_ == 0; }
+
+  // get number of items which can be added without allocation
+  uint capacity() const { return uint(blocks_.size())*BLOCK_SIZE; }
+
+  T &operator[](uint i) {
+    assert(i < size_);
+
+    return blocks_[i/BLOCK_SIZE][i % BLOCK_SIZE];
+  }
+
+  const T &operator[](uint i) const {
+    assert(i < size_);
+
+    return blocks_[i/BLOCK_SIZE][i % BLOCK_SIZE];
+  }
+
+  T &back() { return (*this)[size_ - 1]; }
+
+  const T &back() const { return (*this)[size_ - 1]; }
+
+  // add copy of item to end and return its (stable) address
+  T *push(const T &t) {
+    if (size_ == capacity())
+      blocks_.push_back(std::unique_ptr<T[]>(new T[BLOCK_SIZE]));
+
+    T *p = &blocks_[size_/BLOCK_SIZE][size_ % BLOCK_SIZE];
+
+    *p = t;
+
+    ++size_;
+
+    return p;
+  }
+
+  // remove last item (its slot is reused by the next push)
+  void pop() {
+    assert(size_ > 0);
+
+    --size_;
+  }
+
+  // remove all items (blocks are kept)
+  void clear() {
+    size_ = 0;
+  }
+
+ private:
+  typedef std::vector<std::unique_ptr<T[]>> Blocks;
+
+  Blocks blocks_;
+  uint   size_ { 0 };
+};
+
+#endif
@@ -0,0 +1,288 @@
+#ifndef CHalfEdgeMesh_H
+#define CHalfEdgeMesh_H
+
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cassert>
+
+// half-edge mesh of polygonal faces over a shared vertex array (all index based)
+//
+// faces are added as loops of vertex indices (counter clockwise) and build links each
+// half-edge to its twin. The half-edges of face f are stored consecutively from
+// faceEdge(f) in loop order, so half-edge faceEdge(f) + i goes from vertex i to i + 1
+// of the face. Half-edges with no twin are on the boundary and get a twin boundary
+// half-edge (face -1) linked into boundary loops, so every half-edge has a twin and
+// walks around faces, vertices and the boundary are O(1) per step.
+//
+// an edge shared by more than two faces, or faces with inconsistent orientation, are
+// not supported (such edges are treated as boundary). At a vertex where separate fans
+// of faces meet, vertex walks only visit the fan of vertexEdge.
+//
+// POINT is the vertex point type (only stored)
+//
+template<typename POINT>
+class CHalfEdgeMesh {
+ public:
+  struct HalfEdge {
+    int vertex { -1 }; // origin vertex
+    int face   { -1 }; // face (-1 for boundary)
+    int next   { -1 }; // next half-edge of face (or boundary loop)
+    int prev   { -1 }; // previous half-edge of face (or boundary loop)
+    int twin   { -1 }; // opposite half-edge
+  };
+
+  typedef std::vector<POINT>    Points;
+  typedef std::vector<HalfEdge> HalfEdges;
+  typedef std::vector<int>      Indices;
+
+ public:
+  CHalfEdgeMesh() {
+    faceStart_.push_back(0);
+  }
+
+  // remove all vertices and faces (keeping storage)
+  void clear() {
+    points_    .clear();
+    vertexEdge_.clear();
+    edges_     .clear();
+    faceStart_ .clear();
+
+    faceStart_.push_back(0);
+
+    numFaceEdges_ = 0;
+  }
+
+  //---
+
+  // add vertex and return its index
+  int addVertex(const POINT &point) {
+    points_    .push_back(point);
+    vertexEdge_.push_back(-1);
+
+    return int(points_.size()) - 1;
+  }
+
+  // add face from loop of vertex indices and return its index. Faces must be added
+  // before build
+  template<typename ITER>
+  int addFace(ITER begin, ITER end) {
+    assert(numFaceEdges_ == int(edges_.size()));
+
+    int face  = numFaces();
+    int first = int(edges_.size());
+
+    for (ITER p = begin; p != end; ++p) {
+      HalfEdge edge;
+
+      edge.vertex = *p;
+      edge.face   = face;
+
+      edges_.push_back(edge);
+    }
+
+    int n = int(edges_.size()) - first;
+
+    for (int i = 0; i < n; ++i) {
+      edges_[uint(first + i)].next = first + (i + 1 < n ? i + 1 : 0);
+      edges_[uint(first + i)].prev = first + (i > 0 ? i - 1 : n - 1);
+    }
+
+    faceStart_.push_back(int(edges_.size()));
+
+    numFaceEdges_ = int(edges_.size());
+
+    return face;
+  }
+
+  // link twin half-edges and create boundary loops
+  void build() {
+    // match half-edge a->b with b->a using half-edges sorted by (origin, dest)
+    typedef std::pair<uint64_t, int> EdgeKey;
+
+    std::vector<EdgeKey> keys(static_cast<std::size_t>(numFaceEdges_));
+
+    for (int e = 0; e < numFaceEdges_; ++e)
+      keys[uint(e)] = std::make_pair(edgeKey(vertex(e), vertex(next(e))), e);
+
+    std::sort(keys.begin(), keys.end());
+
+    for (int e = 0; e < numFaceEdges_; ++e) {
+      uint64_t key = edgeKey(vertex(next(e)), vertex(e));
+
+      auto p = std::lower_bound(keys.begin(), keys.end(), EdgeKey(key, -1));
+
+      // only a unique match is a twin
+      if (p == keys.end() || (*p).first != key) continue;
+
+      if (p + 1 != keys.end() && (p + 1)->first == key) continue;
+
+      edges_[uint(e)].twin = (*p).second;
+    }
+
+    // add boundary half-edge opposite each half-edge without a twin
+    for (int e = 0; e < numFaceEdges_; ++e) {
+      if (twin(e) >= 0) continue;
+
+      HalfEdge edge;
+
+      edge.vertex = vertex(next(e));
+      edge.twin   = e;
+
+      edges_.push_back(edge);
+
+      int b = int(edges_.size()) - 1;
+
+      edges_[uint(e)].twin = b;
+    }
+
+    // link boundary loops. The next boundary half-edge is found by rotating counter
+    // clockwise around the end vertex through the faces of the fan it is in
+    for (int b = numFaceEdges_; b < numHalfEdges(); ++b) {
+      int e = twin(b);
+
+      while (! isBoundary(twin(prev(e))))
+        e = twin(prev(e));
+
+      int b1 = twin(prev(e));
+
+      edges_[uint(b )].next = b1;
+      edges_[uint(b1)].prev = b;
+    }
+
+    // outgoing half-edge of each vertex (boundary half-edge for boundary vertices so
+    // vertex walks start at the boundary)
+    for (int e = 0; e < numHalfEdges(); ++e) {
+      int v = vertex(e);
+
+      if (vertexEdge_[uint(v)] < 0 || face(e) < 0)
+        vertexEdge_[uint(v)] = e;
+    }
+  }
+
+  //---
+
+  int numVertices () const { return int(points_.size()); }
+  int numFaces    () const { return int(faceStart_.size()) - 1; }
+  int numHalfEdges() const { return int(edges_.size()); }
+
+  const POINT &point(int v) const { return points_[uint(v)]; }
+
+  const HalfEdge &halfEdge(int e) const { return edges_[uint(e)]; }
+
+  int vertex(int e) const { return edges_[uint(e)].vertex; }
+  int face  (int e) const { return edges_[uint(e)].face  ; }
+  int next  (int e) const { return edges_[uint(e)].next  ; }
+  int prev  (int e) const { return edges_[uint(e)].prev  ; }
+  int twin  (int e) const { return edges_[uint(e)].twin  ; }
+
+  // destination vertex of half-edge
+  int destVertex(int e) const { return vertex(next(e)); }
+
+  bool isBoundary(int e) const { return face(e) < 0; }
+
+  // is half-edge on face with no neighbour across it
+  bool isBoundaryEdge(int e) const { return isBoundary(e) || isBoundary(twin(e)); }
+
+  // face across half-edge (-1 if none)
+  int neighbourFace(int e) const { return face(twin(e)); }
+
+  //---
+
+  // first half-edge of face (half-edge i of face is faceEdge(f) + i)
+  int faceEdge(int f) const { return faceStart_[uint(f)]; }
+
+  int faceSize(int f) const { return faceStart_[uint(f + 1)] - faceStart_[uint(f)]; }
+
+  // an outgoing half-edge of vertex (boundary half-edge for a boundary vertex)
+  int vertexEdge(int v) const { return vertexEdge_[uint(v)]; }
+
+  bool isBoundaryVertex(int v) const {
+    int e = vertexEdge(v);
+
+    return (e >= 0 && isBoundary(e));
+  }
+
+  //---
+
+  // pass half-edges of face to visitor (bool visitor(int e)) in loop order, stopping if
+  // the visitor returns true
+  template<typename VISITOR>
+  bool visitFace(int f, VISITOR &&visitor) const {
+    for (int e = faceStart_[uint(f)]; e < faceStart_[uint(f + 1)]; ++e)
+      if (visitor(e))
+        return true;
+
+    return false;
+  }
+
+  // pass outgoing half-edges of vertex to visitor (bool visitor(int e)) clockwise
+  // starting at vertexEdge(v), stopping if the visitor returns true
+  template<typename VISITOR>
+  bool visitVertex(int v, VISITOR &&visitor) const {
+    int e1 = vertexEdge(v);
+    if (e1 < 0) return false;
+
+    int e = e1;
+
+    do {
+      if (visitor(e))
+        return true;
+
+      e = next(twin(e));
+    } while (e != e1);
+
+    return false;
+  }
+
+  // get faces around vertex (counter clockwise)
+  void vertexFaces(int v, Indices &faces) const {
+    faces.clear();
+
+    visitVertex(v, [&](int e) {
+      if (! isBoundary(e))
+        faces.push_back(face(e));
+
+      return false;
+    });
+
+    std::reverse(faces.begin(), faces.end());
+  }
+
+  // get loops of boundary vertices
+  void boundaryLoops(std::vector<Indices> &loops) const {
+    loops.clear();
+
+    std::vector<bool> done(edges_.size() - uint(numFaceEdges_));
+
+    for (int b = numFaceEdges_; b < numHalfEdges(); ++b) {
+      if (done[uint(b - numFaceEdges_)]) continue;
+
+      loops.push_back(Indices());
+
+      int e = b;
+
+      do {
+        done[uint(e - numFaceEdges_)] = true;
+
+        loops.back().push_back(vertex(e));
+
+        e = next(e);
+      } while (e != b);
+    }
+  }
+
+ private:
+  static uint64_t edgeKey(int v1, int v2) {
+    return (uint64_t(uint32_t(v1)) << 32) | uint64_t(uint32_t(v2));
+  }
+
+ private:
+  Points    points_;            // vertex points
+  Indices   vertexEdge_;        // outgoing half-edge of each vertex
+  HalfEdges edges_;             // face half-edges (by face) then boundary half-edges
+  Indices   faceStart_;         // first half-edge of each face (and end of last)
+  int       numFaceEdges_ { 0 }; // number of face half-edges
+};
+
+#endif
@@ -0,0 +1,590 @@
+#ifndef CHashGrid_H
+#define CHashGrid_H
+
+#include <unordered_map>
+#include <unordered_set>
+#include <queue>
+#include <limits>
+#include <vector>
+#include <thread>
+#include <cstdint>
+#include <cmath>
+#include <cassert>
+
+// uniform grid, stored as a hash of non-empty cells, containing pointers to items of
+// type DATA with an associated bbox of type BBOX
+//
+// supports the same add/reset/query (list, visitor and nearest) interface as CQuadTree
+// so it can be used in its place.
+// Best suited to items of similar size: each item is added to every cell its bbox
+// touches so a point lookup only has to check the items of a single cell.
+//
+// the cell size is the average item size (bbox width or height) unless set explicitly.
+// Items are rehashed when the average size drifts too far from the current cell size.
+//
+// const queries do not modify the grid so can be run concurrently from any number of
+// threads while no thread modifies the grid.
+//
+// grid does not take ownership of data. The application must ensure elements are not
+// deleted while in the grid and are deleted when required.
+//
+// DATA must support:
+//   const BBOX &bbox = data->getBBox();
+//
+// BBOX must support:
+//   constructor BBOX(l, b, r, t);
+//
+//   T l = bbox.getLeft  ();
+//   T b = bbox.getBottom();
+//   T r = bbox.getRight ();
+//   T t = bbox.getTop   ();
+//
+template<typename DATA, typename BBOX, typename T=double>
+class CHashGrid {
+ public:
+  typedef std::vector<DATA *> DataList;
+
+ private:
+  // item and its bbox when added (used for all filtering so queries do not call
+  // DATA::getBBox)
+  struct Item {
+    DATA *data;
+    BBOX  bbox;
+  };
+
+  typedef std::vector<Item>                   Items;
+  typedef std::unordered_map<int64_t, Items> Cells;
+
+  struct CellRange {
+    int64_t x1, y1, x2, y2;
+  };
+
+ public:
+  explicit CHashGrid(const BBOX &bbox=BBOX(1,1,-1,-1), T cellSize=0) :
+   initBBox_(bbox), bbox_(bbox), cellSize_(cellSize), autoCellSize_(cellSize <= 0) {
+  }
+
+  // reset grid (bbox is restored to initial bbox)
+  void reset() {
+    cells_.clear();
+    items_.clear();
+
+    bbox_ = initBBox_;
+
+    sizeSum_ = 0;
+
+    if (autoCellSize_)
+      cellSize_ = 0;
+  }
+
+  // get bounding box (initial bbox grown to include all items)
+  const BBOX &getBBox() const { return bbox_; }
+
+  // get cell size
+  T cellSize() const { return cellSize_; }
+
+  // set fixed cell size (<= 0 for automatic)
+  void setCellSize(T s) {
+    autoCellSize_ = (s <= 0);
+    cellSize_     = (autoCellSize_ ? averageSize() : s);
+
+    rehash();
+  }
+
+  // get number of non-empty cells
+  uint numCells() const { return uint(cells_.size()); }
+
+  uint numElements() const { return uint(items_.size()); }
+
+  //----------
+
+ public:
+  // add data item to the grid
+  void add(DATA *data) {
+    const BBOX &bbox = data->getBBox();
+
+    grow(bbox);
+
+    items_.push_back(Item { data, bbox });
+
+    sizeSum_ += std::max(bbox.getRight() - bbox.getLeft(), bbox.getTop() - bbox.getBottom());
+
+    if (autoCellSize_) {
+      T size = averageSize();
+
+      if (cellSize_ <= 0 || size > 2*cellSize_ || 2*size < cellSize_) {
+        cellSize_ = size;
+
+        rehash();
+
+        return;
+      }
+    }
+
+    addData(items_.back());
+  }
+
+  // add items [begin, end) to the grid. The cell size is only updated (and items
+  // rehashed) once all items are added
+  template<typename ITER>
+  void add(ITER begin, ITER end) {
+    std::size_t n = items_.size();
+
+    for (ITER p = begin; p != end; ++p) {
+      const BBOX &bbox = (*p)->getBBox();
+
+      grow(bbox);
+
+      items_.push_back(Item { *p, bbox });
+
+      sizeSum_ += std::max(bbox.getRight() - bbox.getLeft(), bbox.getTop() - bbox.getBottom());
+    }
+
+    if (autoCellSize_) {
+      T size = averageSize();
+
+      if (cellSize_ <= 0 || size > 2*cellSize_ || 2*size < cellSize_) {
+        cellSize_ = size;
+
+        rehash();
+
+        return;
+      }
+    }
+
+    for (std::size_t i = n; i < items_.size(); ++i)
+      addData(items_[i]);
+  }
+
+  // replace grid contents with items [begin, end). parallel is ignored: it is only
+  // accepted for API parity with CQuadTree::build
+  template<typename ITER>
+  void build(ITER begin, ITER end, bool parallel=false) {
+    (void) parallel;
+
+    reset();
+
+    add(begin, end);
+  }
+
+ private:
+  void addData(const Item &item) {
+    CellRange range = cellRange(item.bbox);
+
+    for (int64_t y = range.y1; y <= range.y2; ++y)
+      for (int64_t x = range.x1; x <= range.x2; ++x)
+        cells_[cellKey(x, y)].push_back(item);
+  }
+
+  void rehash() {
+    cells_.clear();
+
+    if (cellSize_ <= 0) return;
+
+    for (const auto &item : items_)
+      addData(item);
+  }
+
+  void grow(const BBOX &bbox) {
+    if (bbox_.getLeft() > bbox_.getRight())
+      bbox_ = bbox;
+    else
+      bbox_ = BBOX(std::min(bbox_.getLeft  (), bbox.getLeft  ()),
+                   std::min(bbox_.getBottom(), bbox.getBottom()),
+                   std::max(bbox_.getRight (), bbox.getRight ()),
+                   std::max(bbox_.getTop   (), bbox.getTop   ()));
+  }
+
+  T averageSize() const {
+    if (items_.empty()) return 0;
+
+    // avoid zero size cells for point items
+    return std::max(T(sizeSum_/T(items_.size())), T(1E-6));
+  }
+
+  //-------
+
+  // visitor queries pass each matching item to visitor (bool visitor(DATA *)) and stop
+  // as soon as the visitor returns true. They return true if stopped by the visitor
+
+ public:
+  // get data items inside the specified bounding box
+  void getDataInsideBBox(const BBOX &bbox, DataList &dataList) const {
+    dataList.clear();
+
+    addDataInsideBBox(bbox, dataList);
+  }
+
+  void addDataInsideBBox(const BBOX &bbox, DataList &dataList) const {
+    visitDataInsideBBox(bbox, [&](DATA *data) { dataList.push_back(data); return false; });
+  }
+
+  template<typename VISITOR>
+  bool visitDataInsideBBox(const BBOX &bbox, VISITOR &&visitor) const {
+    return visitItemsTouchingBBox(bbox, [&](const Item &item) {
+      return (inside(item.bbox, bbox) && visitor(item.data));
+    });
+  }
+
+  //-------
+
+ public:
+  // get data items touching the specified bounding box
+  void getDataTouchingBBox(const BBOX &bbox, DataList &dataList) const {
+    dataList.clear();
+
+    addDataTouchingBBox(bbox, dataList);
+  }
+
+  void addDataTouchingBBox(const BBOX &bbox, DataList &dataList) const {
+    visitDataTouchingBBox(bbox, [&](DATA *data) { dataList.push_back(data); return false; });
+  }
+
+  template<typename VISITOR>
+  bool visitDataTouchingBBox(const BBOX &bbox, VISITOR &&visitor) const {
+    return visitItemsTouchingBBox(bbox, [&](const Item &item) { return visitor(item.data); });
+  }
+
+ private:
+  template<typename VISITOR>
+  bool visitItemsTouchingBBox(const BBOX &bbox, VISITOR &&visitor) const {
+    if (cells_.empty()) return false;
+
+    CellRange range = cellRange(bbox);
+
+    for (int64_t y = range.y1; y <= range.y2; ++y) {
+      for (int64_t x = range.x1; x <= range.x2; ++x) {
+        auto p = cells_.find(cellKey(x, y));
+        if (p == cells_.end()) continue;
+
+        for (const auto &item : (*p).second) {
+          const BBOX &bbox1 = item.bbox;
+
+          if (! overlaps(bbox1, bbox))
+            continue;
+
+          // item in several cells is only visited from first cell shared with bbox
+          CellRange range1 = cellRange(bbox1);
+
+          if (x != std::max(range.x1, range1.x1) || y != std::max(range.y1, range1.y1))
+            continue;
+
+          if (visitor(item))
+            return true;
+        }
+      }
+    }
+
+    return false;
+  }
+
+  //-------
+
+ public:
+  // get data items which have the specified point inside them
+  void getDataAtPoint(T x, T y, DataList &dataList) const {
+    dataList.clear();
+
+    addDataAtPoint(x, y, dataList);
+  }
+
+  void addDataAtPoint(T x, T y, DataList &dataList) const {
+    visitDataAtPoint(x, y, [&](DATA *data) { dataList.push_back(data); return false; });
+  }
+
+  template<typename VISITOR>
+  bool visitDataAtPoint(T x, T y, VISITOR &&visitor) const {
+    if (cells_.empty()) return false;
+
+    auto p = cells_.find(cellKey(cellCoord(x), cellCoord(y)));
+    if (p == cells_.end()) return false;
+
+    for (const auto &item : (*p).second) {
+      const BBOX &bbox = item.bbox;
+
+      if (x >= bbox.getLeft  () && x <= bbox.getRight() &&
+          y >= bbox.getBottom() && y <= bbox.getTop  () && visitor(item.data))
+        return true;
+    }
+
+    return false;
+  }
+
+  // get first data item which has the specified point inside it and matches
+  // predicate (bool pred(DATA *))
+  template<typename PRED>
+  DATA *findFirstAtPoint(T x, T y, PRED &&pred) const {
+    DATA *found = nullptr;
+
+    visitDataAtPoint(x, y, [&](DATA *data) {
+      if (! pred(data)) return false;
+
+      found = data;
+
+      return true;
+    });
+
+    return found;
+  }
+
+  //-------
+
+ public:
+  // get data items at each point (results[i] for points[i]), optionally split across
+  // threads.
+  //
+  // POINT must support:
+  //   T x = point.x(); T y = point.y();
+  template<typename POINT>
+  void getDataAtPoints(const std::vector<POINT> &points, std::vector<DataList> &results,
+                       bool parallel=false) const {
+    results.clear();
+    results.resize(points.size());
+
+    visitDataAtPoints(points, [&](std::size_t i, DATA *data) {
+      results[i].push_back(data); return false;
+    }, parallel);
+  }
+
+  // get first data item at each point which matches predicate (bool pred(i, DATA *))
+  // (found[i] is null if none)
+  template<typename POINT, typename PRED>
+  void findFirstAtPoints(const std::vector<POINT> &points, std::vector<DATA *> &found,
+                         PRED &&pred, bool parallel=false) const {
+    found.assign(points.size(), nullptr);
+
+    visitDataAtPoints(points, [&](std::size_t i, DATA *data) {
+      if (! pred(i, data)) return false;
+
+      found[i] = data;
+
+      return true;
+    }, parallel);
+  }
+
+  // pass data items at each point to visitor (bool visitor(i, DATA *)). Visiting of a
+  // point stops when the visitor returns true. If parallel the visitor is called from
+  // several threads but only ever from one thread for a given point
+  template<typename POINT, typename VISITOR>
+  void visitDataAtPoints(const std::vector<POINT> &points, VISITOR &&visitor,
+                         bool parallel=false) const {
+    std::size_t n = points.size();
+
+    auto visitRange = [&](std::size_t i1, std::size_t i2) {
+      for (std::size_t i = i1; i < i2; ++i)
+        visitDataAtPoint(points[i].x(), points[i].y(), [&](DATA *data) {
+          return visitor(i, data);
+        });
+    };
+
+    std::size_t nt = (parallel ? std::max(std::thread::hardware_concurrency(), 1U) : 1);
+
+    nt = std::min(nt, n/32);
+
+    if (nt <= 1) {
+      visitRange(0, n);
+      return;
+    }
+
+    std::vector<std::thread> threads;
+
+    for (std::size_t t = 0; t < nt; ++t)
+      threads.emplace_back(visitRange, t*n/nt, (t + 1)*n/nt);
+
+    for (auto &thread : threads)
+      thread.join();
+  }
+
+  //-------
+
+  // nearest queries visit items in order of increasing distance from a point, searching
+  // rings of cells outwards from the point's cell. Distance is the distance to the item's
+  // bbox (zero if inside) unless a distance functor (T dist(DATA *)) is supplied
+  // (functor distances less than the bbox distance are raised to it). Items further
+  // than maxDist are ignored
+
+ public:
+  // get up to k data items nearest to point (nearest first)
+  void getNearest(T x, T y, uint k, DataList &dataList, T maxDist=maxDistance()) const {
+    getNearest(x, y, k, [](DATA *) { return T(0); }, dataList, maxDist);
+  }
+
+  template<typename DIST>
+  void getNearest(T x, T y, uint k, DIST &&dist, DataList &dataList,
+                  T maxDist=maxDistance()) const {
+    dataList.clear();
+
+    if (k == 0) return;
+
+    visitNearest(x, y, dist, [&](DATA *data, T) {
+      dataList.push_back(data);
+
+      return (dataList.size() >= k);
+    }, maxDist);
+  }
+
+  // get nearest data item to point which matches predicate (bool pred(DATA *))
+  template<typename DIST, typename PRED>
+  DATA *findNearest(T x, T y, DIST &&dist, PRED &&pred, T maxDist=maxDistance()) const {
+    DATA *found = nullptr;
+
+    visitNearest(x, y, dist, [&](DATA *data, T) {
+      if (! pred(data)) return false;
+
+      found = data;
+
+      return true;
+    }, maxDist);
+
+    return found;
+  }
+
+  // pass data items to visitor (bool visitor(DATA *, T dist)) nearest first, stopping
+  // as soon as the visitor returns true. Returns true if stopped by the visitor
+  template<typename DIST, typename VISITOR>
+  bool visitNearest(T x, T y, DIST &&dist, VISITOR &&visitor,
+                    T maxDist=maxDistance()) const {
+    if (cells_.empty()) return false;
+
+    // queue of items ordered by distance (lower bound if exact distance not yet known)
+    // and then by push order
+    struct Entry {
+      T           d;
+      std::size_t seq;
+      DATA       *data;
+      bool        exact;
+
+      bool operator<(const Entry &rhs) const {
+        return (d != rhs.d ? d > rhs.d : seq > rhs.seq);
+      }
+    };
+
+    std::priority_queue<Entry> queue;
+
+    std::size_t seq = 0;
+
+    std::unordered_set<DATA *> seen;
+
+    auto push = [&](T d, DATA *data, bool exact) {
+      if (d <= maxDist)
+        queue.push(Entry { d, seq++, data, exact });
+    };
+
+    auto addCell = [&](int64_t cx, int64_t cy) {
+      auto p = cells_.find(cellKey(cx, cy));
+      if (p == cells_.end()) return;
+
+      for (const auto &item : (*p).second)
+        if (seen.insert(item.data).second)
+          push(bboxDistance(item.bbox, x, y), item.data, false);
+    };
+
+    CellRange range = cellRange(bbox_);
+
+    int64_t cx = cellCoord(x), cy = cellCoord(y);
+
+    // items in rings r or more cells from the point's cell are at least
+    // (r - 1)*cellSize + edgeDist away
+    T fx = x - T(cx)*cellSize_, fy = y - T(cy)*cellSize_;
+
+    T edgeDist = std::max(std::min(std::min(fx, cellSize_ - fx),
+                                   std::min(fy, cellSize_ - fy)), T(0));
+
+    auto ringDist = [&](int64_t r) {
+      return (r > 0 ? T(r - 1)*cellSize_ + edgeDist : T(0));
+    };
+
+    // first ring touching the grid and last ring containing any of it
+    int64_t r1 = std::max(std::max(std::max(range.x1 - cx, cx - range.x2),
+                                   std::max(range.y1 - cy, cy - range.y2)), int64_t(0));
+    int64_t r2 = std::max(std::max(std::abs(cx - range.x1), std::abs(cx - range.x2)),
+                          std::max(std::abs(cy - range.y1), std::abs(cy - range.y2)));
+
+    for (int64_t r = r1; ; ++r) {
+      // visit queued items no further than any item not yet seen
+      T d = (r <= r2 ? ringDist(r) : maxDistance());
+
+      while (! queue.empty() && queue.top().d <= d) {
+        Entry e = queue.top(); queue.pop();
+
+        T d = (e.exact ? e.d : std::max(T(dist(e.data)), e.d));
+
+        if (d <= e.d) {
+          if (visitor(e.data, d))
+            return true;
+        }
+        else
+          push(d, e.data, true);
+      }
+
+      if (r > r2 || d > maxDist)
+        break;
+
+      // add items of cells in ring (clipped to grid)
+      int64_t y1 = std::max(cy - r, range.y1), y2 = std::min(cy + r, range.y2);
+      int64_t x1 = std::max(cx - r, range.x1), x2 = std::min(cx + r, range.x2);
+
+      for (int64_t iy = y1; iy <= y2; ++iy) {
+        if (iy == cy - r || iy == cy + r) {
+          for (int64_t ix = x1; ix <= x2; ++ix)
+            addCell(ix, iy);
+        }
+        else {
+          if (cx - r >= range.x1) addCell(cx - r, iy);
+          if (cx + r <= range.x2) addCell(cx + r, iy);
+        }
+      }
+    }
+
+    return false;
+  }
+
+  // get distance from point to bbox (zero if inside)
+  static T bboxDistance(const BBOX &bbox, T x, T y) {
+    T dx = std::max(std::max(bbox.getLeft  () - x, x - bbox.getRight()), T(0));
+    T dy = std::max(std::max(bbox.getBottom() - y, y - bbox.getTop  ()), T(0));
+
+    return std::hypot(dx, dy);
+  }
+
+  static T maxDistance() { return std::numeric_limits<T>::max(); }
+
+  //-------
+
+ private:
+  int64_t cellCoord(T v) const {
+    return int64_t(std::floor(v/cellSize_));
+  }
+
+  CellRange cellRange(const BBOX &bbox) const {
+    return CellRange { cellCoord(bbox.getLeft ()), cellCoord(bbox.getBottom()),
+                       cellCoord(bbox.getRight()), cellCoord(bbox.getTop   ()) };
+  }
+
+  static int64_t cellKey(int64_t x, int64_t y) {
+    return int64_t((uint64_t(x) << 32) ^ (uint64_t(y) & 0xFFFFFFFF));
+  }
+
+  // is bbox1 inside bbox2
+  static bool inside(const BBOX &bbox1, const BBOX &bbox2) {
+    return ((bbox1.getLeft  () >= bbox2.getLeft  () && bbox1.getRight() <= bbox2.getRight()) &&
+            (bbox1.getBottom() >= bbox2.getBottom() && bbox1.getTop  () <= bbox2.getTop  ()));
+  }
+
+  // does bbox1 overlap bbox2
+  static bool overlaps(const BBOX &bbox1, const BBOX &bbox2) {
+    return ((bbox1.getRight() >= bbox2.getLeft  () && bbox1.getLeft  () <= bbox2.getRight()) &&
+            (bbox1.getTop  () >= bbox2.getBottom() && bbox1.getBottom() <= bbox2.getTop  ()));
+  }
+
+ private:
+  BBOX     initBBox_;               // bounding box when constructed
+  BBOX     bbox_;                   // bounding box of all items
+  T        cellSize_     { 0 };     // cell width and height
+  bool     autoCellSize_ { true };  // is cell size average item size
+  T        sizeSum_      { 0 };     // sum of item sizes
+  Items    items_;                  // all items (in add order)
+  Cells    cells_;                  // items of each non-empty cell
+};
+
+#endif
@@ -3,14 +3,27 @@
 #include <CQPropertyItem.h>
 #include <CQPropertyEditor.h>
 #include <QApplication>
+#include <QGuiApplication>
+#include <QElapsedTimer>
 #include <QSplitter>
 #include <QHBoxLayout>
 #include <QPushButton>
 #include <QPainter>
 #include <QPainterPath>
 #include <QHelpEvent>
+#include <QMouseEvent>
 #include <QToolTip>
+#include <QFontMetricsF>
+#include <QWheelEvent>
+#include <QThreadPool>
+#include <QRunnable>
+#include <QThread>
+#include <unordered_set>
+#include <unordered_map>
+#include <numeric>
+#include <limits>
 #include <cassert>
+#include <cstring>
 #include <iostream>
 
 static QColor colors[] = {
@@ -34,6 +47,28 @@ using ModelUtil::range;
 using ModelUtil::rangeBy;
 using ModelUtil::scalePoint;
 
+namespace {
+
+// level of detail thresholds (drawn shape size in pixels). Smaller shapes are drawn as
+// points or without borders. Labels need a shape of several text heights to be read
+const double lodPointPixels  = 2.0;
+const double lodBorderPixels = 6.0;
+const double lodLabelLines   = 3.0;
+
+// get pixels per model unit of painter transform
+double pixelScale(QPainter *p)
+{
+  return std::sqrt(std::fabs(p->transform().determinant()));
+}
+
+// get minimum drawn shape size (pixels) for readable labels with painter font
+double labelPixels(QPainter *p)
+{
+  return lodLabelLines*QFontMetrics(p->font()).height();
+}
+
+}
+
 void drawText(QPainter *p, const QPointF &pos, const QString &text,
               const QColor &c=QColor("#FFFFFF"))
 {
@@ -63,137 +98,467 @@ void drawText(QPainter *p, const QPointF &pos, const QString &text,
 
 //------
 
+namespace {
+
+// add elapsed time (ms) of scope to time less any time added to excludeTime meanwhile
+class BuildTimer {
+ public:
+  BuildTimer(double &time, const double *excludeTime=nullptr) :
+   time_(time), excludeTime_(excludeTime), exclude_(excludeTime ? *excludeTime : 0.0) {
+    timer_.start();
+  }
+
+ ~BuildTimer() {
+    double t = timer_.nsecsElapsed()/1E6;
+
+    if (excludeTime_)
+      t -= *excludeTime_ - exclude_;
+
+    time_ += t;
+  }
+
+ private:
+  double        &time_;
+  const double  *excludeTime_;
+  double         exclude_;
+  QElapsedTimer  timer_;
+};
+
+}
+
+//------
+
 Model::
-Model(Canvas *canvas) :
- canvas_(canvas), margin_(0.1), showSides_(false), bgColor_("#000000"),
- borderColor_("#313E4A"), borderWidth_(0.05), shapeQuadTree_(Rect(-100, -100, 100, 100))
+Model(QObject *parent) :
+ QObject(parent), margin_(0.1), showSides_(false), bgColor_("#000000"),
+ borderColor_("#313E4A"), borderWidth_(0.05), latticeRepeat_(true),
+ shapeIndex_(Rect(-100, -100, 100, 100)), bbox_(-1.0, -1.0, 1.0, 1.0)
 {
+  shapeVertex_.push_back(0);
 }
 
 Model::
 ~Model()
 {
-  for (auto shape : shapes_)
-    delete shape;
 }
 
 void
 Model::
 reset()
 {
-  for (auto shape : shapes_)
-    delete shape;
+  // remove all shapes keeping allocated storage (and tree nodes) for the next build
+  shapeIndex_.reset();
 
   shapes_.clear();
 
-  shapeQuadTree_.reset();
+  shapePos_     .clear();
+  shapeVertex_  .clear();
+  shapeOccupied_.clear();
+  shapeBBox_    .clear();
+  vertices_     .clear();
+  sideLinks_    .clear();
+
+  shapeVertex_.push_back(0);
 
   points_.clear();
+
+  bbox_ = QRectF(-1.0, -1.0, 1.0, 1.0);
+
+  invalidateCaches();
+
+  buildStats_ = BuildStats();
 }
 
 void
 Model::
 setMargin(double m)
 {
+  QWriteLocker locker(&drawLock_);
+
   margin_ = m;
 
-  canvas_->update();
+  insetValid_       = false;
+  drawBatchesValid_ = false;
+
+  notifyChanged(locker);
 }
 
 void
 Model::
 setShowSides(bool b)
 {
+  QWriteLocker locker(&drawLock_);
+
   showSides_ = b;
 
-  canvas_->update();
+  notifyChanged(locker);
 }
 
 void
 Model::
 setBgColor(const QColor &c)
 {
+  QWriteLocker locker(&drawLock_);
+
   bgColor_ = c;
 
-  canvas_->update();
+  notifyChanged(locker);
 }
 
 void
 Model::
 setBorderColor(const QColor &c)
 {
+  QWriteLocker locker(&drawLock_);
+
   borderColor_ = c;
 
-  canvas_->update();
+  notifyChanged(locker);
 }
 
 void
 Model::
 setBorderWidth(double w)
 {
+  QWriteLocker locker(&drawLock_);
+
   borderWidth_ = w;
 
-  canvas_->update();
+  drawBatchesValid_ = false;
+
+  notifyChanged(locker);
+}
+
+void
+Model::
+setBatchDraw(bool b)
+{
+  QWriteLocker locker(&drawLock_);
+
+  batchDraw_ = b;
+
+  notifyChanged(locker);
+}
+
+void
+Model::
+setLodDraw(bool b)
+{
+  QWriteLocker locker(&drawLock_);
+
+  lodDraw_ = b;
+
+  drawBatchesValid_ = false;
+
+  notifyChanged(locker);
+}
+
+// model changed so must be redrawn. The version is changed before the draw lock is
+// released so drawing threads see the change
+void
+Model::
+notifyChanged(QWriteLocker &locker)
+{
+  ++version_;
+
+  locker.unlock();
+
+  emit changed();
+}
+
+// append space for new shape with id of the next stored shape. The new shape must be
+// stored (storeShape, storeShapes) or removed (discardShape) before it is used
+Shape *
+Model::
+allocShape(int numSides)
+{
+  int id = int(shapes_.size());
+
+  Shape *shape = shapes_.push(Shape(this, id));
+
+  shapePos_     .push_back(QPointF(0, 0));
+  shapeOccupied_.push_back(0);
+  shapeBBox_    .push_back(Rect());
+
+  int first = shapeVertex_.back();
+
+  shapeVertex_.push_back(first + numSides);
+
+  vertices_ .resize(uint(first + numSides));
+  sideLinks_.resize(uint(first + numSides));
+
+  return shape;
 }
 
+// create unit regular polygon centred at origin
 Shape *
 Model::
 createShape(int numSides)
 {
-  Shape *shape = new Shape(this, numSides, colors[numSides]);
+  Shape *shape = allocShape(numSides);
 
-  shape->setId(int(shapes_.size()));
+  QPointF *vertices = &vertices_[uint(shapeVertex_[uint(shape->id())])];
+
+  double da = 2.0*M_PI/numSides;
+  double a  = (! (numSides % 2) ? -da/2.0 : 0.0);
+
+  for (auto i : range(numSides)) {
+    vertices[i] = QPointF(cos(a), sin(a));
+
+    a += da;
+  }
 
   return shape;
 }
 
+void
+Model::
+discardShape(Shape *shape)
+{
+  assert(shape->id() == int(shapes_.size()) - 1);
+
+  shapes_.pop();
+
+  shapePos_     .pop_back();
+  shapeOccupied_.pop_back();
+  shapeBBox_    .pop_back();
+  shapeVertex_  .pop_back();
+
+  vertices_ .resize(uint(shapeVertex_.back()));
+  sideLinks_.resize(uint(shapeVertex_.back()));
+}
+
 void
 Model::
 storeShape(Shape *shape)
 {
-  shapes_.push_back(shape);
+  buildStats_.peakShapes = std::max(buildStats_.peakShapes, int(shapes_.size()));
+
+  shapeIndex_.add(shape);
+
+  bbox_ |= shape->getBBox();
+
+  for (auto i : range(shape->numSides()))
+    points_.addData(shape->vertex(i), shape);
+
+  invalidateCaches();
+
+  updateShapeSides(shape);
+}
+
+// store all shapes from firstId (allocated but not stored). All shapes are known so the
+// shape index is rebuilt for them in one pass and then sides are linked
+void
+Model::
+storeShapes(int firstId)
+{
+  buildStats_.peakShapes = std::max(buildStats_.peakShapes, numShapes());
+
+  std::vector<Shape *> shapes;
+
+  for (int shapeId = 0; shapeId < numShapes(); ++shapeId)
+    shapes.push_back(getShape(shapeId));
+
+  shapeIndex_.build(shapes.begin(), shapes.end(), /*parallel*/shapes.size() > 10000);
+
+  invalidateCaches();
+
+  for (int shapeId = firstId; shapeId < numShapes(); ++shapeId) {
+    Shape *shape = getShape(shapeId);
+
+    bbox_ |= shape->getBBox();
+
+    for (auto i : range(shape->numSides()))
+      points_.addData(shape->vertex(i), shape);
+  }
+
+  BuildTimer timer(buildStats_.updateShapeSidesTime);
+
+  // link all sides of new shapes and open sides of old shapes with one batched lookup
+  std::vector<QPointF> points;
+  std::vector<int>     sideNums, shapeIds;
+
+  for (int shapeId = 0; shapeId < numShapes(); ++shapeId) {
+    Shape *shape = getShape(shapeId);
+
+    bool openOnly = (shapeId < firstId);
+
+    if (openOnly && shape->fullyOccupied())
+      continue;
 
-  shapeQuadTree_.add(shape);
+    shape->addSideProbes(openOnly, points, sideNums);
 
-  shape->updatePoly();
+    shapeIds.resize(sideNums.size(), shapeId);
+  }
+
+  std::vector<Shape *> shapes1;
 
-  for (auto point : shape->poly())
-    points_.addData(point, shape);
+  getShapesAtPoints(points, shapes1, /*inner*/false, /*parallel*/points.size() > 10000);
+
+  for (std::size_t i = 0; i < points.size(); ++i)
+    getShape(shapeIds[i])->linkSide(sideNums[i], shapes1[i], points[i]);
 }
 
 int
 Model::
 addShape(int numSides)
 {
+  BuildTimer timer(buildStats_.addShapeTime, &buildStats_.updateShapeSidesTime);
+
   Shape *shape = createShape(numSides);
 
   storeShape(shape);
 
-  updateShapeSides();
-
   return shape->id();
 }
 
+void
+Model::
+build(int id, int repeatCount)
+{
+  QWriteLocker locker(&drawLock_);
+
+  reset();
+
+  if      (id == 0) {
+    auto shapeId = addShape(6);
+
+    auto shapeIds1 = addShapesToSides({shapeId}, range(6), 3);
+    auto shapeIds2 = addShapesToSides(shapeIds1, {1}     , 6);
+
+    repeat(repeatCount);
+  }
+  else if (id == 1) {
+    auto shapeId = addShape(12);
+
+    auto shapeIds1 = addShapesToSides({shapeId}, rangeBy(0, 12, 2), 6);
+    auto shapeIds2 = addShapesToSides({shapeId}, rangeBy(1, 12, 2), 4);
+    auto shapeIds3 = addShapesToSides(shapeIds2, {2}              , 12);
+
+    repeat(repeatCount);
+  }
+  else if (id == 2) {
+    auto shapeId = addShape(4);
+
+    auto shapeIds1 = addShapesToSides({shapeId}, range(4), 3);
+    auto shapeIds2 = addShapesToSides(shapeIds1, {1}     , 4);
+    auto shapeIds3 = addShapesToSides(shapeIds2, {2, 3}  , 3);
+    auto shapeIds4 = addShapesToSides(shapeIds3, {2}     , 4);
+
+    repeat(repeatCount);
+  }
+  else if (id == 3) {
+    auto shapeId = addShape(6);
+
+    auto shapeIds1 = addShapesToSides({shapeId}, range(6), 3);
+    auto shapeIds2 = addShapesToSides(shapeIds1, {1}     , 3);
+    auto shapeIds3 = addShapesToSides(shapeIds1, {2}     , 3);
+    auto shapeIds4 = addShapesToSides(shapeIds3, {1}     , 6);
+
+    repeat(repeatCount);
+  }
+  else if (id == 4) {
+    auto shapeId = addShape(8);
+
+    auto shapeIds1 = addShapesToSides({shapeId}, rangeBy(1, 8, 2), 4);
+    auto shapeIds2 = addShapesToSides(shapeIds1, {1}             , 8);
+
+    repeat(repeatCount);
+  }
+  else if (id == 5) {
+    auto shapeId = addShape(12);
+
+    auto shapeIds1 = addShapesToSides({shapeId}, rangeBy(0, 12, 2), 3);
+    auto shapeIds2 = addShapesToSides({shapeId}, rangeBy(1, 12, 2), 4);
+    auto shapeIds3 = addShapesToSides(shapeIds2, {1, 3}           , 3);
+    auto shapeIds4 = addShapesToSides(shapeIds2, {2}              , 12);
+
+    repeat(repeatCount);
+  }
+  else if (id == 6) {
+    auto shapeId = addShape(6);
+
+    auto shapeIds1 = addShapesToSides({shapeId}, range(6), 4);
+    auto shapeIds2 = addShapesToSides(shapeIds1, {1}     , 3);
+    auto shapeIds3 = addShapesToSides(shapeIds1, {2}     , 6);
+
+    repeat(repeatCount);
+  }
+  else if (id == 7) {
+    auto shapeId = addShape(4);
+
+    auto shapeIds1 = addShapesToSides({shapeId}, {0, 2}, 4); shapeIds1.push_back(0);
+    auto shapeIds2 = addShapesToSides(shapeIds1, {1, 3}, 3);
+    auto shapeIds3 = addShapesToSides(shapeIds2, {1   }, 3);
+    auto shapeIds4 = addShapesToSides(shapeIds3, {2   }, 4);
+
+    repeat(repeatCount);
+  }
+  else if (id == 8) {
+    auto shapeId = addShape(3);
+
+    auto shapeIds1 = addShapesToSides({shapeId}, range(3), 3);
+    auto shapeIds2 = addShapesToSides(shapeIds1, {1, 2}  , 3);
+
+    repeat(repeatCount);
+  }
+  else if (id == 9) {
+    auto shapeId = addShape(5);
+
+    auto shapeIds1 = addShapesToSides({shapeId}, range(5), 4);
+
+    for (auto i : range(8)) {
+      assert(i >= 0);
+      auto shapeIds2 = addShapesToSides(shapeIds1, {2}, 5);
+           shapeIds1 = addShapesToSides(shapeIds2, {2}, 4);
+    }
+  }
+  else if (id == 10) {
+    auto shapeId = addShape(6);
+
+    auto shapeIds1 = addShapesToSides({shapeId}, range(6), 4);
+    auto shapeIds2 = addShapesToSides(shapeIds1, {2}     , 3);
+    auto shapeIds3 = addShapesToSides(shapeIds2, {1}     , 4);
+    auto shapeIds4 = addShapesToSides(shapeIds2, {2}     , 4);
+    auto shapeIds5 = addShapesToSides(shapeIds4, {2}     , 6);
+
+    (void) addShapesToSides(shapeIds1, {1}, 3);
+    (void) addShapesToSides(shapeIds3, {1}, 3);
+
+    repeat(repeatCount);
+  }
+  else if (id == 11) {
+    auto shapeId = addShape(8);
+
+    auto shapeIds1 = addShapesToSides({shapeId}, rangeBy(0, 8, 2), 6);
+    auto shapeIds2 = addShapesToSides(shapeIds1, {3}             , 8);
+
+    repeat(repeatCount);
+  }
+  else if (id == 12) {
+    auto shapeId = addShape(12);
+
+    auto shapeIds1 = addShapesToSides({shapeId}, rangeBy(0, 12, 2), 3);
+    auto shapeIds2 = addShapesToSides({shapeId}, rangeBy(1, 12, 2), 12);
+
+    repeat(repeatCount);
+  }
+}
+
 std::vector<int>
 Model::
 addShapesToSides(const std::vector<int> &shapeIds, const std::vector<int> &sideNums, int numSides)
 {
+  BuildTimer timer(buildStats_.addShapesToSidesTime, &buildStats_.updateShapeSidesTime);
+
   std::vector<int> shapeIds1;
 
+  // occupied sides are not skipped: placing onto one finds the existing shape, which
+  // is re-oriented to the placed side and returned so later calls can build from it
   for (auto shapeId : shapeIds) {
     Shape *shape = getShape(shapeId);
 
-    if (shape->fullyOccupied())
-      continue;
-
     for (auto sideNum : sideNums) {
-      Side &side = shape->side(sideNum);
-
-      if (side.hasShapeSide())
-        continue;
-
-      //---
-
       Shape *shape1 = createShape(numSides);
 
       placeShape(shape, sideNum, shape1);
@@ -203,7 +568,9 @@ addShapesToSides(const std::vector<int> &shapeIds, const std::vector<int> &sideN
       if (shape2 && shape2->numSides() == shape1->numSides()) {
         shape2->copyOver(shape1);
 
-        delete shape1;
+        discardShape(shape1);
+
+        updateShapeSides(shape2, /*relink*/true);
 
         shapeIds1.push_back(shape2->id());
 
@@ -216,8 +583,6 @@ addShapesToSides(const std::vector<int> &shapeIds, const std::vector<int> &sideN
     }
   }
 
-  updateShapeSides();
-
   return shapeIds1;
 }
 
@@ -225,9 +590,9 @@ void
 Model::
 placeShape(Shape *shape, int sideNum, Shape *shape1)
 {
-  Side &side = shape->side(sideNum);
+  Side side = shape->side(sideNum);
 
-  Side &side1 = shape1->side(0);
+  Side side1 = shape1->side(0);
 
   double l = side.length()/side1.length();
 
@@ -247,16 +612,26 @@ void
 Model::
 repeat(int depth)
 {
-  std::vector<Shape *> repeatShapes = shapes_;
+  if (depth <= 0 || shapes_.empty())
+    return;
 
-  Shape *repeatShape = repeatShapes.front();
+  BuildTimer timer(buildStats_.repeatTime, &buildStats_.updateShapeSidesTime);
+
+  if (latticeRepeat() && repeatLattice(depth))
+    return;
+
+  int numRepeatShapes = numShapes();
+
+  Shape *repeatShape = getShape(0);
 
   for (int i = 0; i < depth; ++i) {
     std::vector<int> shapeIds;
 
-    std::vector<Shape *> shapes1 = shapes_;
+    int numShapes1 = numShapes();
+
+    for (int shapeId = 0; shapeId < numShapes1; ++shapeId) {
+      Shape *shape = getShape(shapeId);
 
-    for (auto shape : shapes1) {
       if (shape->numSides() != repeatShape->numSides() || shape->fullyOccupied())
         continue;
 
@@ -265,17 +640,15 @@ repeat(int depth)
 
       auto d = shape->pos() - repeatShape->pos();
 
-      for (auto shape1 : repeatShapes) {
-        Shape *shape2 = shape1->dup();
-
-        shape2->setId(int(shapes_.size()));
+      for (int shapeId1 = 0; shapeId1 < numRepeatShapes; ++shapeId1) {
+        Shape *shape2 = getShape(shapeId1)->dup();
 
         shape2->translate(d);
 
         Shape *shape3 = getShapeAtPos(shape2->pos());
 
         if (shape3) {
-          delete shape2;
+          discardShape(shape2);
 
           continue;
         }
@@ -285,609 +658,2375 @@ repeat(int depth)
         shapeIds.push_back(shape2->id());
       }
     }
-
-    updateShapeSides();
   }
 }
 
-void
+// repeat by translating the patch to each point of the lattice generated by the first
+// round's translations reachable in depth steps. Each translate of each shape is
+// generated exactly once so no shape is created only to be discarded as a duplicate.
+bool
 Model::
-updateShapeSides()
+repeatLattice(int depth)
 {
-  for (auto shape : shapes_)
-    shape->updateSides();
-}
+  typedef std::pair<int, int> Coord;
 
-QRectF
-Model::
-getBBox() const
-{
-  QRectF r(-1.0, -1.0, 1.0, 1.0);
+  auto coordKey = [](const Coord &c) {
+    return (uint64_t(uint32_t(c.first)) << 32) | uint32_t(c.second);
+  };
 
-  for (auto shape : shapes_)
-    r |= shape->getBBox();
+  std::vector<Shape *> repeatShapes;
 
-  return r;
-}
+  for (int shapeId = 0; shapeId < numShapes(); ++shapeId)
+    repeatShapes.push_back(getShape(shapeId));
 
-Shape *
-Model::
-getShapeAtPos(const QPointF &p) const
-{
-  ShapeQuadTree::DataList shapes;
+  Shape *repeatShape = repeatShapes.front();
 
-  shapeQuadTree_.getDataAtPoint(p.x(), p.y(), shapes);
+  auto isSameType = [](const Shape *shape1, const Shape *shape2) {
+    return (shape1->numSides() == shape2->numSides() &&
+            ModelUtil::realEq(shape1->angle(), shape2->angle()));
+  };
 
-  for (auto shape : shapes)
-    if (shape->contains(p))
-      return shape;
+  //---
 
-  return nullptr;
-}
+  // get translations (as used by first round of repeat) and their lattice
+  std::vector<QPointF> vectors;
 
-void
-Model::
-draw(QPainter *p)
-{
-  if (canvas_->dual()) {
-    for (auto &point : points_)
-      drawDual(p, point.first, point.second);
-  }
-  else {
-    for (auto shape : shapes_)
-      shape->draw(p);
+  for (auto shape : repeatShapes) {
+    if (shape == repeatShape || shape->fullyOccupied() || ! isSameType(shape, repeatShape))
+      continue;
+
+    vectors.push_back(shape->pos() - repeatShape->pos());
   }
-}
 
-void
-Model::
-drawDual(QPainter *p, const QPointF &point, const std::set<Shape *> &shapes)
-{
-  p->setPen(QPen(QColor(255, 0, 0), 0.03));
-  p->drawPoint(point);
+  Lattice lattice;
 
-  std::vector<QPointF> points;
+  if (! lattice.init(vectors))
+    return false;
 
-  for (auto shape : shapes) {
-    auto p = scalePoint(shape->pos(), 0.1, point);
+  std::vector<Coord> steps;
 
-    points.push_back(p);
-  }
+  for (const auto &v : vectors) {
+    int i, j;
 
-  if (points.size() > 2) {
-    std::sort(points.begin(), points.end(), PointAngleCmp(point));
+    if (! lattice.coords(v, i, j))
+      return false;
 
-    QPainterPath path;
+    steps.push_back(Coord(i, j));
+  }
 
-    for (auto point : points) {
-      if (! path.elementCount())
-        path.moveTo(point);
-      else
-        path.lineTo(point);
-    }
+  //---
 
-    path.closeSubpath();
+  // get translates reachable in depth steps
+  std::vector<Coord> translates { Coord(0, 0) };
 
-    if (borderWidth() > 0.0)
-      p->setPen(QPen(borderColor(), borderWidth()));
-    else
-      p->setPen(QPen(QColor(0, 0, 0, 0)));
+  std::unordered_set<uint64_t> translateKeys { coordKey(translates.front()) };
 
-    p->setBrush(QColor("#477984"));
+  std::size_t n1 = 0;
 
-    p->drawPath(path);
-  }
-}
+  for (int i = 0; i < depth; ++i) {
+    std::size_t n2 = translates.size();
 
-//------
+    for (std::size_t j = n1; j < n2; ++j) {
+      for (const auto &step : steps) {
+        Coord t(translates[j].first + step.first, translates[j].second + step.second);
 
-Shape::
-Shape(Model *model, int numSides, const QColor &c) :
- model_(model), id_(0), numSides_(numSides), numOccupied_(0), c_(c), pos_(0, 0)
-{
-  addSides();
-}
+        if (translateKeys.insert(coordKey(t)).second)
+          translates.push_back(t);
+      }
+    }
 
-Shape::
-~Shape()
-{
-  for (auto side : sides_)
-    delete side;
-}
+    n1 = n2;
+  }
 
-Shape *
-Shape::
-dup() const
-{
-  Shape *shape = new Shape(model_, 0, c_);
+  //---
 
-  shape->id_       = 0;
-  shape->numSides_ = numSides_;
-  shape->pos_      = pos_;
+  // group patch shapes into orbits of shapes which are lattice translates of each other
+  // and store each shape's lattice offset from the first shape of its orbit
+  struct Orbit {
+    Shape*               shape;
+    std::vector<Coord>   offsets;
+    std::vector<Shape *> shapes;
+  };
 
-  for (auto &side : sides_)
-    shape->sides_.push_back(side->dup(shape));
+  std::vector<Orbit> orbits;
 
-  return shape;
-}
+  for (auto shape : repeatShapes) {
+    bool found = false;
 
-void
-Shape::
-copyOver(Shape *shape)
-{
-  std::swap(sides_, shape->sides_);
+    for (auto &orbit : orbits) {
+      int i, j;
 
-  poly_.clear();
-}
+      if (! isSameType(shape, orbit.shape) ||
+          ! lattice.coords(shape->pos() - orbit.shape->pos(), i, j))
+        continue;
 
-void
-Shape::
-addSides()
-{
-  double da = 2.0*M_PI/numSides();
-  double a  = (! (numSides() % 2) ? -da/2.0 : 0.0);
+      orbit.offsets.push_back(Coord(i, j));
+      orbit.shapes .push_back(shape);
 
-  QPointF p1;
+      found = true;
 
-  for (auto i : range(numSides() + 1)) {
-    double s = sin(a);
-    double c = cos(a);
+      break;
+    }
 
-    auto p2 = QPointF(pos().x() + c, pos().y() + s);
+    if (! found)
+      orbits.push_back(Orbit { shape, { Coord(0, 0) }, { shape } });
+  }
 
-    if (i > 0)
-      sides_.push_back(new Side(this, i - 1, p1, p2));
+  //---
 
-    a += da;
+  // add each new lattice position of each orbit once (all are stored together)
+  int firstId = numShapes();
 
-    p1 = p2;
+  for (const auto &orbit : orbits) {
+    std::unordered_set<uint64_t> coords;
+
+    for (const auto &offset : orbit.offsets)
+      coords.insert(coordKey(offset));
+
+    for (std::size_t i = 0; i < orbit.shapes.size(); ++i) {
+      const auto &offset = orbit.offsets[i];
+
+      for (const auto &t : translates) {
+        Coord c(offset.first + t.first, offset.second + t.second);
+
+        if (! coords.insert(coordKey(c)).second)
+          continue;
+
+        Shape *shape = orbit.shapes[i]->dup();
+
+        shape->translate(lattice.point(t.first, t.second));
+      }
+    }
   }
+
+  storeShapes(firstId);
+
+  return true;
 }
 
 void
-Shape::
-translate(const QPointF &p)
+Model::
+updateShapeSides(Shape *shape, bool relink)
 {
-  pos_ += p;
+  // link sides of shape and of all shapes whose side probes (see Shape::updateSides)
+  // can land inside it. Existing links of other shapes stay valid unless shape's sides
+  // have been renumbered (relink)
+  BuildTimer timer(buildStats_.updateShapeSidesTime);
+
+  shape->updateSides();
+
+  double d = Shape::sideProbeOffset();
 
-  for (auto &side : sides_)
-    side->move(p);
+  Rect bbox(shape->getBBox().adjusted(-d, -d, d, d));
+
+  shapeIndex_.visitDataTouchingBBox(bbox, [&](Shape *shape1) {
+    if (shape1 == shape)
+      return false;
+
+    if (relink)
+      shape1->updateSides();
+    else if (! shape1->fullyOccupied())
+      shape1->updateSides(/*openOnly*/true);
+
+    return false;
+  });
+}
 
-  poly_.clear();
+QRectF
+Model::
+getBBox() const
+{
+  return bbox_;
 }
 
+// get shape at each point (as getShapeAtPos) using a single batched lookup
 void
-Shape::
-scale(double s)
+Model::
+getShapesAtPoints(const std::vector<QPointF> &points, std::vector<Shape *> &shapes,
+                  bool inner, bool parallel) const
+{
+  shapeIndex_.findFirstAtPoints(points, shapes, [&](std::size_t i, Shape *shape) {
+    return shape->contains(points[i], inner);
+  }, parallel);
+}
+
+Shape *
+Model::
+getShapeAtPos(const QPointF &p, bool inner) const
 {
-  for (auto &side : sides_)
-    side->scale(pos(), s);
+  return shapeIndex_.findFirstAtPoint(p.x(), p.y(), [&](Shape *shape) {
+    return shape->contains(p, inner);
+  });
+}
 
-  poly_.clear();
+// get shape nearest to point (closest outer polygon) within maxDist
+Shape *
+Model::
+getNearestShape(const QPointF &p, double maxDist) const
+{
+  return shapeIndex_.findNearest(p.x(), p.y(), [&](Shape *shape) {
+    return shape->distance(p);
+  }, [](Shape *) { return true; }, maxDist);
 }
 
-void
-Shape::
-rotate(double a)
+// get half-edge mesh of shapes (built on first use after the shapes change)
+const Model::Mesh &
+Model::
+mesh()
 {
-  for (auto &side : sides_)
-    side->rotate(pos(), a);
+  if (meshValid_)
+    return mesh_;
+
+  mesh_.clear();
+
+  for (const auto &vertex : points_)
+    mesh_.addVertex(vertex.point());
+
+  std::vector<int> loop;
+
+  for (int shapeId = 0; shapeId < numShapes(); ++shapeId) {
+    Shape *shape = getShape(shapeId);
+
+    loop.clear();
+
+    for (int i = 0, n = shape->numSides(); i < n; ++i)
+      loop.push_back(points_.find(shape->vertex(i)));
+
+    mesh_.addFace(loop.begin(), loop.end());
+  }
+
+  mesh_.build();
 
-  poly_.clear();
+  meshValid_ = true;
+
+  return mesh_;
 }
 
-QRectF
-Shape::
-getBBox() const
+// get dual tiling (built on first use after the shapes change). There is a dual face
+// for each vertex with three or more shapes around it
+const Model::Mesh &
+Model::
+dual()
 {
-  QRectF r(pos_, QSizeF(0.01, 0.01));
+  if (dualValid_)
+    return dual_;
+
+  const Mesh &mesh = this->mesh();
+
+  dual_      .clear();
+  dualVertex_.clear();
+  dualPolys_ .clear();
+
+  dualFace_.assign(uint(mesh.numVertices()), -1);
+
+  for (int shapeId = 0; shapeId < numShapes(); ++shapeId)
+    dual_.addVertex(getShape(shapeId)->pos());
+
+  std::vector<int> faces;
 
-  for (auto side : sides_)
-    r |= side->getBBox();
+  for (int v = 0; v < mesh.numVertices(); ++v) {
+    // shapes around vertex are already in angle order
+    mesh.vertexFaces(v, faces);
 
-  return r;
+    if (faces.size() < 3) continue;
+
+    dualFace_[uint(v)] = dual_.addFace(faces.begin(), faces.end());
+
+    dualVertex_.push_back(v);
+
+    QPolygonF poly;
+
+    for (auto face : faces)
+      poly.push_back(scalePoint(getShape(face)->pos(), 0.1, mesh.point(v)));
+
+    dualPolys_.push_back(poly);
+  }
+
+  dual_.build();
+
+  dualValid_ = true;
+
+  return dual_;
 }
 
-double
-Shape::
-angle() const
+// invalidate data derived from the shapes (mesh, dual and draw batches)
+void
+Model::
+invalidateCaches()
 {
-  double a = 1E50;
+  meshValid_ = false;
+  dualValid_ = false;
 
-  for (auto side : sides_)
-    a = std::min(a, side->angle());
+  insetValid_       = false;
+  drawBatchesValid_ = false;
+  dualBatchValid_   = false;
 
-  return a;
+  ++version_;
 }
 
-bool
-Shape::
-contains(const QPointF &p) const
+// get vertices of shape inset by margin
+const QPointF *
+Model::
+insetVertices(int shapeId)
 {
-  updatePoly();
+  if (! insetValid_)
+    updateInsetVertices();
 
-  return ipoly_.containsPoint(p, Qt::OddEvenFill);
+  return &insetVertices_[uint(shapeVertex_[uint(shapeId)])];
 }
 
+// inset vertices of all shapes by margin towards shape centre in one pass (as
+// ModelUtil::scalePoint)
 void
-Shape::
-updatePoly() const
+Model::
+updateInsetVertices()
 {
-  if (! poly_.empty()) return;
+  insetVertices_.resize(vertices_.size());
+
+  double m = margin();
 
-  QVector<QPointF> points, ipoints;
+  for (int shapeId = 0, n = numShapes(); shapeId < n; ++shapeId) {
+    const QPointF &o = shapePos_[uint(shapeId)];
 
-  for (auto side : sides_) {
-    auto p = side->start();
+    double ox = o.x(), oy = o.y();
 
-    points.push_back(p);
+    for (int i = shapeVertex_[uint(shapeId)]; i < shapeVertex_[uint(shapeId + 1)]; ++i) {
+      double dx = vertices_[uint(i)].x() - ox;
+      double dy = vertices_[uint(i)].y() - oy;
 
-    auto ip = scalePoint(p, 0.1, pos());
+      double f = 1.0 - m/std::sqrt(dx*dx + dy*dy);
 
-    ipoints.push_back(ip);
+      insetVertices_[uint(i)] = QPointF(ox + f*dx, oy + f*dy);
+    }
   }
 
-  poly_  = QPolygonF(points);
-  ipoly_ = QPolygonF(ipoints);
+  insetValid_ = true;
 }
 
+// get ids (ascending) of shapes touching rect
 void
-Shape::
-updateSides()
+Model::
+getShapesInRect(const QRectF &rect, std::vector<int> &shapeIds) const
+{
+  shapeIds.clear();
+
+  shapeIndex_.visitDataTouchingBBox(Rect(rect), [&](Shape *shape) {
+    shapeIds.push_back(shape->id());
+    return false;
+  });
+
+  std::sort(shapeIds.begin(), shapeIds.end());
+}
+
+// draw shapes (or dual) touching rect (all if rect is null) in id order.
+//
+// If retain is false no whole model batches or laid out labels are used or kept, so
+// (after prepareDraw) draw only reads the model and can be called from several threads
+// at once while they hold the draw lock for read
+void
+Model::
+draw(QPainter *p, bool dual, const QRectF &rect, bool retain)
 {
-  numOccupied_ = 0;
+  // cull using shape index unless all shapes are in rect. Rect is grown by the pen
+  // width so borders of shapes just outside it are drawn
+  bool all = rect.isNull();
+
+  std::vector<int> shapeIds;
+
+  if (! all) {
+    double d = std::max(borderWidth(), 0.03);
+
+    QRectF rect1 = rect.adjusted(-d, -d, d, d);
+
+    all = rect1.contains(getBBox());
+
+    if (! all)
+      getShapesInRect(rect1, shapeIds);
+  }
+
+  if (dual) {
+    const Mesh &mesh = this->mesh();
+
+    this->dual();
+
+    // whole model batch is retained
+    if (all && retain && batchDraw() && dualBatchValid_) {
+      drawDualBatch(p, dualPoints_, dualPath_);
+      return;
+    }
+
+    std::vector<int> vertices;
+
+    if (all)
+      vertices = range(mesh.numVertices());
+    else {
+      // dual polygon of a vertex is inside the shapes around it
+      for (auto shapeId : shapeIds)
+        mesh.visitFace(shapeId, [&](int e) { vertices.push_back(mesh.vertex(e)); return false; });
+
+      std::sort(vertices.begin(), vertices.end());
+
+      vertices.erase(std::unique(vertices.begin(), vertices.end()), vertices.end());
+    }
+
+    if      (! batchDraw()) {
+      for (auto v : vertices)
+        drawDual(p, v);
+    }
+    else if (all && retain) {
+      dualPoints_.clear();
+      dualPath_ = QPainterPath();
+
+      addDualBatch(vertices, dualPoints_, dualPath_);
+
+      dualBatchValid_ = true;
+
+      drawDualBatch(p, dualPoints_, dualPath_);
+    }
+    else {
+      QPolygonF    points;
+      QPainterPath path;
+
+      addDualBatch(vertices, points, path);
+
+      drawDualBatch(p, points, path);
+    }
+  }
+  else {
+    double pixelScale = ::pixelScale(p);
+
+    bool retained = (retain && drawBatchesValid_ && pixelScale >= drawBatchesMinScale_ &&
+                     pixelScale < drawBatchesMaxScale_);
+
+    if (all && (! batchDraw() || ! retained))
+      shapeIds = range(numShapes());
+
+    if      (! batchDraw()) {
+      for (auto shapeId : shapeIds)
+        getShape(shapeId)->draw(p);
+
+      return;
+    }
+    else if (all && retain) {
+      if (! retained) {
+        drawBatches_.clear();
+
+        drawEdges_ = QPainterPath();
 
-  for (auto side : sides_) {
-    auto p = side->mid() + 0.01*side->vector(pos());
+        addDrawBatches(shapeIds, pixelScale, drawBatches_, drawEdges_,
+                       drawBatchesMinScale_, drawBatchesMaxScale_);
 
-    Shape *shape = model_->getShapeAtPos(p);
-    if (! shape) continue;
+        drawBatchesValid_ = true;
+      }
+
+      drawBatches(p, drawBatches_, drawEdges_);
+    }
+    else {
+      DrawBatches  batches;
+      QPainterPath edges;
+      double       minScale, maxScale;
+
+      addDrawBatches(shapeIds, pixelScale, batches, edges, minScale, maxScale);
 
-    side->setShapeSide(shape->id(), shape->getSide(p));
+      drawBatches(p, batches, edges);
+    }
+
+    if (showSides()) {
+      if (all)
+        shapeIds = range(numShapes());
 
-    ++numOccupied_;
+      drawLabels(p, shapeIds, pixelScale, /*cache*/retain);
+    }
   }
 }
 
-int
-Shape::
-getSide(const QPointF &p) const
+// build data draw creates when first needed (mesh, dual, shape bboxes and inset
+// vertices) so draw with retain false does not change the model
+void
+Model::
+prepareDraw(bool dual)
 {
-  double minDist = 0;
-  int    minSide = -1;
+  mesh();
 
-  for (auto side : sides_) {
-    double d = ModelUtil::dist(p, side->mid());
+  if (dual)
+    this->dual();
 
-    if (minSide < 0 || d < minDist) {
-      minSide = side->num();
-      minDist = d;
+  for (int shapeId = 0, n = numShapes(); shapeId < n; ++shapeId)
+    (void) getShape(shapeId)->getBBox();
+
+  if (! insetValid_)
+    updateInsetVertices();
+}
+
+// draw labels of shapes (as Shape::drawLabels) in one pass using pre laid out text
+// (cached if cache is true). Labels outside the device or overlapping an already drawn
+// label are skipped
+void
+Model::
+drawLabels(QPainter *p, const std::vector<int> &shapeIds, double pixelScale, bool cache)
+{
+  double labelPixels = ::labelPixels(p);
+
+  QFont      font      = p->font();
+  QTransform transform = p->transform();
+
+  QRectF deviceRect(0, 0, p->device()->width(), p->device()->height());
+
+  // drawn label rects by cell (of label height) for overlap test
+  double cellSize = QFontMetricsF(font).height();
+
+  std::unordered_map<uint64_t, std::vector<QRectF>> cellRects;
+
+  auto cellKey = [](int ix, int iy) {
+    return (uint64_t(uint32_t(ix)) << 32) | uint64_t(uint32_t(iy));
+  };
+
+  p->save();
+
+  p->setWorldMatrixEnabled(false);
+
+  p->setPen(QColor("#FFFFFF"));
+
+  auto drawLabel = [&](const QPointF &pos, int i) {
+    QStaticText text = (cache ? labelText(i, font) : QStaticText(QString::number(i)));
+
+    QSizeF  size   = text.size();
+    QPointF center = transform.map(pos);
+
+    QRectF rect(center.x() - size.width()/2.0, center.y() - size.height()/2.0,
+                size.width(), size.height());
+
+    if (! deviceRect.intersects(rect)) return;
+
+    int ix1 = int(std::floor(rect.left  ()/cellSize));
+    int iy1 = int(std::floor(rect.top   ()/cellSize));
+    int ix2 = int(std::floor(rect.right ()/cellSize));
+    int iy2 = int(std::floor(rect.bottom()/cellSize));
+
+    for (int iy = iy1; iy <= iy2; ++iy) {
+      for (int ix = ix1; ix <= ix2; ++ix) {
+        auto pr = cellRects.find(cellKey(ix, iy));
+        if (pr == cellRects.end()) continue;
+
+        for (const auto &rect1 : (*pr).second)
+          if (rect1.intersects(rect))
+            return;
+      }
+    }
+
+    for (int iy = iy1; iy <= iy2; ++iy)
+      for (int ix = ix1; ix <= ix2; ++ix)
+        cellRects[cellKey(ix, iy)].push_back(rect);
+
+    p->drawStaticText(rect.topLeft(), text);
+  };
+
+  for (auto shapeId : shapeIds) {
+    Shape *shape = getShape(shapeId);
+
+    if (drawLevel(shape, pixelScale, labelPixels) != DrawLevel::LABELS) continue;
+
+    for (int i = 0, n = shape->numSides(); i < n; ++i) {
+      Side side = shape->side(i);
+
+      if (side.hasShapeSide()) continue;
+
+      drawLabel(side.mid(), i);
     }
+
+    drawLabel(shape->pos(), shapeId);
   }
 
-  return minSide;
+  p->restore();
 }
 
-QString
-Shape::
-tip() const
+// get text of integer label laid out for font (cached until font changes)
+const QStaticText &
+Model::
+labelText(int i, const QFont &font)
 {
-  auto str = QString("%1:").arg(id());
+  if (! (font == labelFont_)) {
+    labelFont_ = font;
 
-  for (auto side : sides_) {
-    if (! side->hasShapeSide())
-      str += QString(" %1").arg(side->num());
+    labelTexts_.clear();
   }
 
-  return str;
+  while (int(labelTexts_.size()) <= i) {
+    QStaticText text(QString::number(int(labelTexts_.size())));
+
+    text.setPerformanceHint(QStaticText::AggressiveCaching);
+
+    text.prepare(QTransform(), font);
+
+    labelTexts_.push_back(text);
+  }
+
+  return labelTexts_[uint(i)];
 }
 
+// get level of detail of shape for pixel scale
+Model::DrawLevel
+Model::
+drawLevel(const Shape *shape, double pixelScale, double labelPixels) const
+{
+  if (! lodDraw())
+    return DrawLevel::LABELS;
+
+  double size = shape->pixelSize(pixelScale);
+
+  if (size < lodPointPixels ) return DrawLevel::POINT;
+  if (size < lodBorderPixels) return DrawLevel::FILL;
+  if (size < labelPixels    ) return DrawLevel::BORDER;
+
+  return DrawLevel::LABELS;
+}
+
+// add inset polygons (or points) of shapes to batch of their colour by level of detail
+// at pixel scale. The range of pixel scales with the same levels is returned in minScale
+// and maxScale.
+//
+// When the margin is zero the borders of adjacent shapes coincide, so instead of each
+// shape stroking its own outline the sides of bordered shapes are added once to edges
 void
-Shape::
-draw(QPainter *p)
+Model::
+addDrawBatches(const std::vector<int> &shapeIds, double pixelScale, DrawBatches &batches,
+               QPainterPath &edges, double &minScale, double &maxScale) const
 {
-  double s = model_->margin();
+  minScale = 0.0;
+  maxScale = std::numeric_limits<double>::max();
 
-  QPainterPath path;
+  bool sharedEdges = (margin() <= 0.0 && borderWidth() > 0.0);
 
-  for (auto side : sides_) {
-    if (! path.elementCount())
-      path.moveTo(scalePoint(side->start(), s, pos()));
+  std::vector<int> borderIds;
 
-    path.lineTo(scalePoint(side->end(), s, pos()));
-  }
+  for (auto shapeId : shapeIds) {
+    Shape *shape = getShape(shapeId);
 
-  path.closeSubpath();
+    // labels are drawn separately so only point and border thresholds matter here
+    DrawLevel level = std::min(drawLevel(shape, pixelScale, 0.0), DrawLevel::BORDER);
 
-  if (model_->borderWidth() > 0.0)
-    p->setPen(QPen(model_->borderColor(), model_->borderWidth()));
-  else
-    p->setPen(QPen(QColor(0, 0, 0, 0)));
+    if (lodDraw()) {
+      double size = shape->pixelSize(1.0);
 
-  p->setBrush(c_);
+      for (double pixels : { lodPointPixels, lodBorderPixels }) {
+        if (size <= 0.0) continue;
 
-  p->drawPath(path);
+        double scale = pixels/size;
 
-  //---
+        if (pixelScale >= scale)
+          minScale = std::max(minScale, scale);
+        else
+          maxScale = std::min(maxScale, scale);
+      }
+    }
 
-  if (model_->showSides()) {
-    p->setPen(QPen(QColor(255, 0, 0), 0.03));
+    const QColor &color = shape->color();
 
-    for (auto side : sides_) {
-      if (side->hasShapeSide()) continue;
+    auto p = std::find_if(batches.begin(), batches.end(),
+                          [&](const DrawBatch &batch) { return batch.color == color; });
 
-      //p->drawLine(side->start(), side->end());
+    if (p == batches.end())
+      p = batches.insert(batches.end(), DrawBatch { color, QPainterPath(), QPainterPath(),
+                                                    QPolygonF() });
 
-      drawText(p, side->mid(), QString("%1").arg(side->num()));
+    if (level == DrawLevel::POINT) {
+      (*p).points.push_back(shape->pos());
+      continue;
     }
 
-    drawText(p, pos(), QString("%1").arg(id()));
+    QPainterPath &path = (level == DrawLevel::FILL ? (*p).fillPath : (*p).path);
+
+    path.addPolygon(shape->insetPolygon());
+    path.closeSubpath();
+
+    if (sharedEdges && level == DrawLevel::BORDER)
+      borderIds.push_back(shapeId);
   }
+
+  if (sharedEdges)
+    addEdgePath(borderIds, edges);
 }
 
-//------
+void
+Model::
+addEdgePath(const std::vector<int> &shapeIds, QPainterPath &path) const
+{
+  for (auto shapeId : shapeIds) {
+    Shape *shape = getShape(shapeId);
+
+    for (int i = 0, n = shape->numSides(); i < n; ++i) {
+      Side side = shape->side(i);
+
+      // shared side is added by the shape with the lower id
+      const ShapeSide &shapeSide = side.shapeSide();
+
+      if (shapeSide.isValid() && shapeSide.shapeId < shapeId &&
+          std::binary_search(shapeIds.begin(), shapeIds.end(), shapeSide.shapeId))
+        continue;
+
+      path.moveTo(side.start());
+      path.lineTo(side.end  ());
+    }
+  }
+}
+
+// fill and stroke each batch with one call (per level of detail). If there are shared
+// edges the batches are only filled and the edges stroked with one call
+void
+Model::
+drawBatches(QPainter *p, const DrawBatches &batches, const QPainterPath &edges) const
+{
+  if (borderWidth() > 0.0 && edges.isEmpty())
+    p->setPen(QPen(borderColor(), borderWidth()));
+  else
+    p->setPen(Qt::NoPen);
+
+  for (const auto &batch : batches) {
+    if (batch.path.isEmpty()) continue;
+
+    p->setBrush(batch.color);
+
+    p->drawPath(batch.path);
+  }
+
+  // small shapes (no border)
+  p->setPen(Qt::NoPen);
+
+  for (const auto &batch : batches) {
+    if (batch.fillPath.isEmpty()) continue;
+
+    p->setBrush(batch.color);
+
+    p->drawPath(batch.fillPath);
+  }
+
+  // sub-pixel shapes as points
+  for (const auto &batch : batches) {
+    if (batch.points.isEmpty()) continue;
+
+    QPen pen(batch.color, lodPointPixels);
+
+    pen.setCosmetic(true);
+
+    p->setPen(pen);
+
+    p->drawPoints(batch.points);
+  }
+
+  if (! edges.isEmpty()) {
+    p->setPen  (QPen(borderColor(), borderWidth()));
+    p->setBrush(Qt::NoBrush);
+
+    p->drawPath(edges);
+  }
+}
 
+// add points and dual polygons of vertices to dual batch
+void
+Model::
+addDualBatch(const std::vector<int> &vertices, QPolygonF &points, QPainterPath &path) const
+{
+  for (auto v : vertices) {
+    points.push_back(mesh_.point(v));
+
+    int face = dualFace_[uint(v)];
+    if (face < 0) continue;
+
+    path.addPolygon(dualPolys_[uint(face)]);
+    path.closeSubpath();
+  }
+}
+
+// draw dual points then polygons (which cover the points of their vertices)
+void
+Model::
+drawDualBatch(QPainter *p, const QPolygonF &points, const QPainterPath &path) const
+{
+  p->setPen(QPen(QColor(255, 0, 0), 0.03));
+  p->drawPoints(points);
+
+  if (borderWidth() > 0.0)
+    p->setPen(QPen(borderColor(), borderWidth()));
+  else
+    p->setPen(Qt::NoPen);
+
+  p->setBrush(QColor("#477984"));
+
+  p->drawPath(path);
+}
+
+// draw shapes as ids. Antialiasing is disabled so each pixel is a single id
+void
+Model::
+drawIds(QPainter *p, const QRectF &rect)
+{
+  p->setRenderHint(QPainter::Antialiasing, false);
+
+  p->setPen(Qt::NoPen);
+
+  std::vector<int> shapeIds;
+
+  getShapesInRect(rect, shapeIds);
+
+  for (auto shapeId : shapeIds) {
+    int first = shapeVertex_[uint(shapeId)];
+    int n     = shapeVertex_[uint(shapeId + 1)] - first;
+
+    QPolygonF poly(n);
+
+    std::copy(&vertices_[uint(first)], &vertices_[uint(first)] + n, poly.begin());
+
+    p->setBrush(idColor(shapeId));
+
+    p->drawPolygon(poly);
+  }
+}
+
+// encode shape id as colour (black is no shape)
+QColor
+Model::
+idColor(int shapeId)
+{
+  uint i = uint(shapeId + 1);
+
+  return QColor(int((i >> 16) & 0xFF), int((i >> 8) & 0xFF), int(i & 0xFF));
+}
+
+// decode shape id from colour (-1 if none)
+int
+Model::
+colorId(QRgb rgb)
+{
+  return ((qRed(rgb) << 16) | (qGreen(rgb) << 8) | qBlue(rgb)) - 1;
+}
+
+void
+Model::
+drawDual(QPainter *p, int v) const
+{
+  p->setPen(QPen(QColor(255, 0, 0), 0.03));
+  p->drawPoint(mesh_.point(v));
+
+  int face = dualFace_[uint(v)];
+  if (face < 0) return;
+
+  if (borderWidth() > 0.0)
+    p->setPen(QPen(borderColor(), borderWidth()));
+  else
+    p->setPen(QPen(QColor(0, 0, 0, 0)));
+
+  p->setBrush(QColor("#477984"));
+
+  p->drawPolygon(dualPolys_[uint(face)]);
+}
+
+//------
+
+Side::
+Side(Model *model, int shapeId, int num) :
+ model_(model), shapeId_(shapeId), num_(num), first_(0), numSides_(0)
+{
+  if (model_) {
+    first_    = model_->shapeVertex_[uint(shapeId_)];
+    numSides_ = model_->shapeVertex_[uint(shapeId_ + 1)] - first_;
+  }
+}
+
+Shape *
+Side::
+shape() const
+{
+  return model_->getShape(shapeId_);
+}
+
+const QPointF &
+Side::
+start() const
+{
+  return model_->vertices_[uint(first_ + num_)];
+}
+
+const QPointF &
+Side::
+end() const
+{
+  return model_->vertices_[uint(first_ + (num_ + 1 < numSides_ ? num_ + 1 : 0))];
+}
+
+const ShapeSide &
+Side::
+shapeSide() const
+{
+  return model_->sideLinks_[uint(first_ + num_)];
+}
+
+void
+Side::
+setShapeSide(int shapeId, int sideNum)
+{
+  model_->sideLinks_[uint(first_ + num_)] = ShapeSide(shapeId, sideNum);
+}
+
+//------
+
+Shape::
+Shape(Model *model, int id) :
+ model_(model), id_(id)
+{
+}
+
+int
+Shape::
+numSides() const
+{
+  return model_->shapeVertex_[uint(id_ + 1)] - model_->shapeVertex_[uint(id_)];
+}
+
+const QColor &
+Shape::
+color() const
+{
+  return colors[numSides()];
+}
+
+const QPointF &
+Shape::
+pos() const
+{
+  return model_->shapePos_[uint(id_)];
+}
+
+const QPointF &
+Shape::
+vertex(int i) const
+{
+  return model_->vertices_[uint(model_->shapeVertex_[uint(id_)] + i)];
+}
+
+int
+Shape::
+numOccupied() const
+{
+  return model_->shapeOccupied_[uint(id_)];
+}
+
+// new (unstored) shape with same position and vertices
+Shape *
+Shape::
+dup() const
+{
+  Shape *shape = model_->allocShape(numSides());
+
+  int first  = model_->shapeVertex_[uint(id_)];
+  int first1 = model_->shapeVertex_[uint(shape->id_)];
+
+  model_->shapePos_ [uint(shape->id_)] = pos();
+  model_->shapeBBox_[uint(shape->id_)] = model_->shapeBBox_[uint(id_)];
+
+  std::copy(&model_->vertices_[uint(first)], &model_->vertices_[uint(first)] + numSides(),
+            &model_->vertices_[uint(first1)]);
+
+  return shape;
+}
+
+// replace vertices with those of shape (same number of sides) and clear side links
+void
+Shape::
+copyOver(Shape *shape)
+{
+  int n      = numSides();
+  int first  = model_->shapeVertex_[uint(id_)];
+  int first1 = model_->shapeVertex_[uint(shape->id_)];
+
+  for (int i = 0; i < n; ++i) {
+    model_->vertices_ [uint(first + i)] = model_->vertices_[uint(first1 + i)];
+    model_->sideLinks_[uint(first + i)] = ShapeSide();
+  }
+
+  model_->shapeBBox_[uint(id_)] = Rect();
+}
+
+void
+Shape::
+translate(const QPointF &p)
+{
+  model_->shapePos_[uint(id_)] += p;
+
+  QPointF *vertices = &model_->vertices_[uint(model_->shapeVertex_[uint(id_)])];
+
+  for (int i = 0, n = numSides(); i < n; ++i)
+    vertices[i] += p;
+
+  model_->shapeBBox_[uint(id_)] = Rect();
+}
+
+void
+Shape::
+scale(double s)
+{
+  QPointF o = pos();
+
+  QPointF *vertices = &model_->vertices_[uint(model_->shapeVertex_[uint(id_)])];
+
+  for (int i = 0, n = numSides(); i < n; ++i)
+    vertices[i] = s*(vertices[i] - o) + o;
+
+  model_->shapeBBox_[uint(id_)] = Rect();
+}
+
+void
+Shape::
+rotate(double a)
+{
+  QPointF o = pos();
+
+  double s = sin(a);
+  double c = cos(a);
+
+  QPointF *vertices = &model_->vertices_[uint(model_->shapeVertex_[uint(id_)])];
+
+  for (int i = 0, n = numSides(); i < n; ++i) {
+    QPointF d = vertices[i] - o;
+
+    vertices[i] = QPointF(d.x()*c - d.y()*s, d.x()*s + d.y()*c) + o;
+  }
+
+  model_->shapeBBox_[uint(id_)] = Rect();
+}
+
+// get bbox (cached until vertices change). Must not be called concurrently with a
+// change to the shape's vertices
+const Rect &
+Shape::
+getBBox() const
+{
+  Rect &bbox = model_->shapeBBox_[uint(id_)];
+
+  if (! bbox.isNull())
+    return bbox;
+
+  const QPointF &o = pos();
+
+  double x1 = o.x(), y1 = o.y(), x2 = o.x() + 0.01, y2 = o.y() + 0.01;
+
+  for (int i = 0, n = numSides(); i < n; ++i) {
+    const QPointF &p = vertex(i);
+
+    x1 = std::min(x1, p.x()); y1 = std::min(y1, p.y());
+    x2 = std::max(x2, p.x()); y2 = std::max(y2, p.y());
+  }
+
+  bbox = QRectF(x1, y1, x2 - x1, y2 - y1);
+
+  return bbox;
+}
+
+double
+Shape::
+angle() const
+{
+  double a = 1E50;
+
+  for (int i = 0, n = numSides(); i < n; ++i)
+    a = std::min(a, side(i).angle());
+
+  return a;
+}
+
+bool
+Shape::
+contains(const QPointF &p, bool inner) const
+{
+  // odd-even crossing test of outer polygon or of polygon inset by 0.1
+  auto point = [&](int i) {
+    return (inner ? scalePoint(vertex(i), 0.1, pos()) : vertex(i));
+  };
+
+  int n = numSides();
+
+  bool in = false;
+
+  QPointF p1 = point(n - 1);
+
+  for (int i = 0; i < n; ++i) {
+    QPointF p2 = point(i);
+
+    if ((p2.y() > p.y()) != (p1.y() > p.y()) &&
+        p.x() < (p1.x() - p2.x())*(p.y() - p2.y())/(p1.y() - p2.y()) + p2.x())
+      in = ! in;
+
+    p1 = p2;
+  }
+
+  return in;
+}
+
+// get distance from point to outer polygon (zero if inside)
+double
+Shape::
+distance(const QPointF &p) const
+{
+  if (contains(p, /*inner*/false))
+    return 0.0;
+
+  int n = numSides();
+
+  double d = -1;
+
+  QPointF p1 = vertex(n - 1);
+
+  for (int i = 0; i < n; ++i) {
+    QPointF p2 = vertex(i);
+
+    // distance to nearest point on edge p1->p2
+    QPointF v  = p2 - p1;
+    double  l2 = v.x()*v.x() + v.y()*v.y();
+    double  t  = (l2 > 0 ? QPointF::dotProduct(p - p1, v)/l2 : 0.0);
+
+    double d1 = ModelUtil::dist(p, p1 + std::min(std::max(t, 0.0), 1.0)*v);
+
+    if (d < 0 || d1 < d)
+      d = d1;
+
+    p1 = p2;
+  }
+
+  return d;
+}
+
+void
+Shape::
+updateSides(bool openOnly)
+{
+  std::vector<QPointF> points;
+  std::vector<int>     sideNums;
+
+  addSideProbes(openOnly, points, sideNums);
+
+  // probe is inside the margin of the adjacent shape so test its outer polygon
+  std::vector<Shape *> shapes;
+
+  model_->getShapesAtPoints(points, shapes, /*inner*/false);
+
+  for (std::size_t i = 0; i < points.size(); ++i)
+    linkSide(sideNums[i], shapes[i], points[i]);
+}
+
+// add probe point outside each side to update (open sides or all sides, clearing
+// their links)
+void
+Shape::
+addSideProbes(bool openOnly, std::vector<QPointF> &points, std::vector<int> &sideNums)
+{
+  if (! openOnly)
+    model_->shapeOccupied_[uint(id_)] = 0;
+
+  for (int i = 0, n = numSides(); i < n; ++i) {
+    Side side = this->side(i);
+
+    if (openOnly) {
+      if (side.hasShapeSide()) continue;
+    }
+    else
+      side.setShapeSide(-1, -1);
+
+    points  .push_back(side.mid() + sideProbeOffset()*side.vector(pos()));
+    sideNums.push_back(i);
+  }
+}
+
+// link side to shape found at its probe point p (if any)
+void
+Shape::
+linkSide(int sideNum, Shape *shape, const QPointF &p)
+{
+  if (! shape) return;
+
+  side(sideNum).setShapeSide(shape->id(), shape->getSide(p));
+
+  ++model_->shapeOccupied_[uint(id_)];
+}
+
+int
+Shape::
+getSide(const QPointF &p) const
+{
+  double minDist = 0;
+  int    minSide = -1;
+
+  for (int i = 0, n = numSides(); i < n; ++i) {
+    double d = ModelUtil::dist(p, side(i).mid());
+
+    if (minSide < 0 || d < minDist) {
+      minSide = i;
+      minDist = d;
+    }
+  }
+
+  return minSide;
+}
+
+QString
+Shape::
+tip() const
+{
+  auto str = QString("%1:").arg(id());
+
+  for (int i = 0, n = numSides(); i < n; ++i) {
+    if (! side(i).hasShapeSide())
+      str += QString(" %1").arg(i);
+  }
+
+  return str;
+}
+
+// get size of drawn polygon (inset by margin on all sides)
+double
+Shape::
+pixelSize(double pixelScale) const
+{
+  const Rect &bbox = getBBox();
+
+  double size = std::max(bbox.width(), bbox.height()) - 2*model_->margin();
+
+  return std::max(size, 0.0)*pixelScale;
+}
+
+// get polygon inset by model margin (as drawn)
+QPolygonF
+Shape::
+insetPolygon() const
+{
+  const QPointF *vertices = model_->insetVertices(id_);
+
+  QPolygonF poly(numSides());
+
+  std::copy(vertices, vertices + numSides(), poly.begin());
+
+  return poly;
+}
+
+void
+Shape::
+draw(QPainter *p) const
+{
+  typedef Model::DrawLevel DrawLevel;
+
+  DrawLevel level = model_->drawLevel(this, pixelScale(p), labelPixels(p));
+
+  if (level == DrawLevel::POINT) {
+    QPen pen(color(), lodPointPixels);
+
+    pen.setCosmetic(true);
+
+    p->setPen(pen);
+
+    p->drawPoint(pos());
+
+    return;
+  }
+
+  QPainterPath path;
+
+  path.addPolygon(insetPolygon());
+
+  path.closeSubpath();
+
+  if (model_->borderWidth() > 0.0 && level != DrawLevel::FILL)
+    p->setPen(QPen(model_->borderColor(), model_->borderWidth()));
+  else
+    p->setPen(QPen(QColor(0, 0, 0, 0)));
+
+  p->setBrush(color());
+
+  p->drawPath(path);
+
+  //---
+
+  if (model_->showSides() && level == DrawLevel::LABELS)
+    drawLabels(p);
+}
+
+// draw numbers of open sides and shape id
+void
+Shape::
+drawLabels(QPainter *p) const
+{
+  p->setPen(QPen(QColor(255, 0, 0), 0.03));
+
+  for (int i = 0, n = numSides(); i < n; ++i) {
+    Side side = this->side(i);
+
+    if (side.hasShapeSide()) continue;
+
+    drawText(p, side.mid(), QString("%1").arg(i));
+  }
+
+  drawText(p, pos(), QString("%1").arg(id()));
+}
+
+//------
+
+bool
+Lattice::
+init(const std::vector<QPointF> &vectors)
+{
+  static const double tol    = 1E-3;
+  static const int    maxDen = 64;
+
+  rank_ = 0;
+
+  basis_[0] = QPointF(0, 0);
+  basis_[1] = QPointF(0, 0);
+
+  auto cross = [](const QPointF &v1, const QPointF &v2) {
+    return v1.x()*v2.y() - v1.y()*v2.x();
+  };
+
+  //---
+
+  // use shortest independent vectors as trial basis
+  std::vector<QPointF> vectors1;
+
+  for (const auto &v : vectors) {
+    if (ModelUtil::hypot(v) > tol)
+      vectors1.push_back(v);
+  }
+
+  if (vectors1.empty())
+    return true;
+
+  std::sort(vectors1.begin(), vectors1.end(), [](const QPointF &v1, const QPointF &v2) {
+    return ModelUtil::hypot(v1) < ModelUtil::hypot(v2);
+  });
+
+  QPointF v1 = vectors1.front();
+  QPointF v2 = QPointF(-v1.y(), v1.x());
+
+  for (const auto &v : vectors1) {
+    if (fabs(cross(v1, v)) > tol*ModelUtil::hypot(v1)*ModelUtil::hypot(v)) {
+      v2 = v;
+      break;
+    }
+  }
+
+  double det = cross(v1, v2);
+
+  //---
+
+  // get rational coordinates of vectors in trial basis and common denominator
+  auto fracDen = [&](double x) {
+    for (int d = 1; d <= maxDen; ++d) {
+      if (fabs(d*x - std::round(d*x)) < tol)
+        return d;
+    }
+
+    return 0;
+  };
+
+  std::vector<std::pair<double, double>> coords;
+
+  int den = 1;
+
+  for (const auto &v : vectors1) {
+    double a = cross(v , v2)/det;
+    double b = cross(v1, v )/det;
+
+    for (auto x : { a, b }) {
+      int d = fracDen(x);
+
+      if (d == 0)
+        return false;
+
+      den = den*d/std::gcd(den, d);
+
+      if (den > maxDen)
+        return false;
+    }
+
+    coords.push_back(std::make_pair(a, b));
+  }
+
+  //---
+
+  // reduce integer generators (scaled by den) to Hermite normal form basis:
+  //   (ax, 0) and (vx, vy) with vy the gcd of all y coordinates
+  auto extGcd = [](long a, long b, long &s, long &t) {
+    long s1 = 1, t1 = 0, s2 = 0, t2 = 1;
+
+    while (b != 0) {
+      long q = a/b, r = a - q*b;
+
+      a = b; b = r;
+
+      long s3 = s1 - q*s2; s1 = s2; s2 = s3;
+      long t3 = t1 - q*t2; t1 = t2; t2 = t3;
+    }
+
+    if (a < 0) { a = -a; s1 = -s1; t1 = -t1; }
+
+    s = s1; t = t1;
+
+    return a;
+  };
+
+  long ax = 0, vx = 0, vy = 0;
+
+  for (const auto &c : coords) {
+    long wx = std::lround(c.first *den);
+    long wy = std::lround(c.second*den);
+
+    long s, t;
+
+    long g = extGcd(vy, wy, s, t);
+
+    if (g == 0) {
+      ax = std::gcd(ax, wx);
+      continue;
+    }
+
+    long ux = (wy/g)*vx - (vy/g)*wx;
+
+    vx = s*vx + t*wx;
+    vy = g;
+
+    ax = std::gcd(ax, ux);
+  }
+
+  if (ax != 0)
+    vx %= ax;
+
+  //---
+
+  auto toPoint = [&](long x, long y) {
+    return (double(x)*v1 + double(y)*v2)/den;
+  };
+
+  if (ax != 0)
+    basis_[rank_++] = toPoint(ax, 0);
+
+  if (vy != 0)
+    basis_[rank_++] = toPoint(vx, vy);
+
+  return true;
+}
+
+bool
+Lattice::
+coords(const QPointF &v, int &i, int &j) const
+{
+  static const double tol = 1E-3;
+
+  i = 0;
+  j = 0;
+
+  if      (rank_ == 0)
+    return (ModelUtil::hypot(v) < tol);
+  else if (rank_ == 1) {
+    const QPointF &b = basis_[0];
+
+    double a = (v.x()*b.x() + v.y()*b.y())/(b.x()*b.x() + b.y()*b.y());
+
+    i = int(std::lround(a));
+
+    return (ModelUtil::dist(v, i*b) < tol);
+  }
+  else {
+    const QPointF &b1 = basis_[0];
+    const QPointF &b2 = basis_[1];
+
+    double det = b1.x()*b2.y() - b1.y()*b2.x();
+
+    double a = (v .x()*b2.y() - v .y()*b2.x())/det;
+    double b = (b1.x()*v .y() - b1.y()*v .x())/det;
+
+    i = int(std::lround(a));
+    j = int(std::lround(b));
+
+    return (ModelUtil::dist(v, point(i, j)) < tol);
+  }
+}
+
+//------
+
+Renderer::
+Renderer(Model *model) :
+ model_(model), scale_(1.0), dual_(false), center_(0, 0)
+{
+}
+
+// paint model to device. Only shapes in the exposed rect (whole device if null) are
+// drawn
+void
+Renderer::
+paint(QPainter *p, const QRect &exposed)
+{
+  int w = p->device()->width ();
+  int h = p->device()->height();
+
+  updateTransform(w, h);
+
+  paintModel(p, model_, dual(), transform_, exposed, /*retain*/true);
+}
+
+// paint model to device with transform. Only shapes in the exposed rect (whole device
+// if null) are drawn
+void
+Renderer::
+paintModel(QPainter *p, Model *model, bool dual, const QTransform &transform,
+           const QRect &exposed, bool retain)
+{
+  int w = p->device()->width ();
+  int h = p->device()->height();
+
+  p->setRenderHints(QPainter::Antialiasing | QPainter::TextAntialiasing);
+
+  p->fillRect(QRect(0, 0, w, h), QBrush(model->bgColor()));
+
+  p->setTransform(transform);
+
+  QRectF rect = transform.inverted().mapRect(
+                  QRectF(exposed.isNull() ? QRect(0, 0, w, h) : exposed));
+
+  model->draw(p, dual, rect, retain);
+}
+
+// paint shape ids of model to device with transform
+void
+Renderer::
+paintIds(QPainter *p, Model *model, const QTransform &transform)
+{
+  int w = p->device()->width ();
+  int h = p->device()->height();
+
+  p->fillRect(QRect(0, 0, w, h), QColor(0, 0, 0));
+
+  p->setTransform(transform);
+
+  model->drawIds(p, transform.inverted().mapRect(QRectF(0, 0, w, h)));
+}
+
+// update transform to fit model bbox to device of size (w, h) at scale (keeping aspect)
+// with center at device centre
+void
+Renderer::
+updateTransform(int w, int h)
+{
+  auto r = model_->getBBox();
+
+  double s = std::max(r.width(), r.height());
+  double f = std::min(w, h)*scale()/s;
+
+  transform_.reset();
+
+  transform_.translate(w/2.0, h/2.0);
+  transform_.scale    (f, -f);
+  transform_.translate(-center_.x(), -center_.y());
+
+  itransform_ = transform_.inverted();
+}
+
+//------
+
+namespace {
+
+// integer division rounding down
+int floorDiv(int a, int b)
+{
+  return (a >= 0 ? a/b : -((b - 1 - a)/b));
+}
+
+}
+
+// renders one tile (image or shape ids) holding the model draw lock. The tile is not
+// rendered if the model has changed or it has left the view since it was requested
+class TileCache::RenderTask : public QRunnable {
+ public:
+  RenderTask(TileCache *cache, const TileKey &key, uint version, bool dual,
+             uint generation, uint request, const QTransform &transform) :
+   cache_(cache), key_(key), version_(version), dual_(dual), generation_(generation),
+   request_(request), transform_(transform) {
+  }
+
+  void run() override {
+    Model *model = cache_->model_;
+
+    QImage image;
+
+    // skip tile which has left the view since it was requested
+    if (cache_->isWanted(key_, request_)) {
+      QReadLocker locker(model->drawLock());
+
+      if (model->version() == version_) {
+        if (key_.ids) {
+          image = QImage(tileSize, tileSize, QImage::Format_RGB32);
+
+          QPainter p(&image);
+
+          Renderer::paintIds(&p, model, transform_);
+        }
+        else {
+          image = QImage(tileSize, tileSize, QImage::Format_ARGB32_Premultiplied);
+
+          QPainter p(&image);
+
+          Renderer::paintModel(&p, model, dual_, transform_, QRect(), /*retain*/false);
+        }
+      }
+    }
+
+    cache_->tileRendered(RenderedTile { key_, generation_, request_, image });
+  }
+
+ private:
+  TileCache* cache_;
+  TileKey    key_;
+  uint       version_;
+  bool       dual_;
+  uint       generation_;
+  uint       request_;
+  QTransform transform_;
+};
+
+TileCache::
+TileCache(Model *model, QObject *parent) :
+ QObject(parent), model_(model)
+{
+  // leave a core for the GUI thread
+  pool_ = new QThreadPool(this);
+
+  pool_->setMaxThreadCount(std::max(QThread::idealThreadCount() - 1, 1));
+}
+
+TileCache::
+~TileCache()
+{
+  pool_->clear();
+  pool_->waitForDone();
+}
+
+// remove all tiles (tiles being rendered are discarded when done)
+void
+TileCache::
+clear()
+{
+  pool_->clear();
+
+  tiles_.clear();
+
+  {
+  QMutexLocker locker(&mutex_);
+
+  wanted_.clear();
+  }
+
+  ++generation_;
+
+  valid_ = false;
+}
+
+// draw view of model with transform (model to device, no rotation) to painter device
+// from tiles. Returns true if all tiles needed were available
+bool
+TileCache::
+draw(QPainter *p, const QTransform &transform, bool dual)
+{
+  // tiles of old model (or dual) are discarded. Draw data is built here so render
+  // threads only read the model
+  if (! valid_ || model_->version() != version_ || dual != dual_) {
+    clear();
+
+    model_->prepareDraw(dual);
+
+    auto r = model_->getBBox();
+
+    version_   = model_->version();
+    dual_      = dual;
+    tileScale_ = tileSize/std::max(r.width(), r.height());
+    valid_     = true;
+  }
+
+  ++frame_;
+
+  int w = p->device()->width ();
+  int h = p->device()->height();
+
+  p->fillRect(QRect(0, 0, w, h), QBrush(model_->bgColor()));
+
+  p->setRenderHint(QPainter::SmoothPixmapTransform);
+
+  // tiles (in level pixels, y down) covering view
+  int level = viewLevel(transform);
+
+  double scale = std::ldexp(tileScale_, level)/tileSize;
+
+  QRectF rect = transform.inverted().mapRect(QRectF(0, 0, w, h));
+
+  int tx1 = int(std::floor( rect.left  ()*scale));
+  int tx2 = int(std::floor( rect.right ()*scale));
+  int ty1 = int(std::floor(-rect.bottom()*scale));
+  int ty2 = int(std::floor(-rect.top   ()*scale));
+
+  std::vector<TileKey> missing;
+
+  bool complete = true;
+
+  for (int ty = ty1; ty <= ty2; ++ty) {
+    for (int tx = tx1; tx <= tx2; ++tx) {
+      TileKey key { level, tx, ty };
+
+      auto pt = tiles_.find(key);
+
+      if (pt != tiles_.end() && ! (*pt).second.image.isNull()) {
+        (*pt).second.used = frame_;
+
+        p->drawImage(tileTarget(transform, key), (*pt).second.image,
+                     QRectF(0, 0, tileSize, tileSize));
+
+        continue;
+      }
+
+      complete = false;
+
+      drawCoarser(p, transform, key);
+
+      if (pt == tiles_.end())
+        missing.push_back(key);
+      else
+        (*pt).second.used = frame_;
+    }
+  }
+
+  // drop requests for tiles no longer in view (their render tasks are skipped)
+  auto inView = [&](const TileKey &key) {
+    return (key.level == level && key.tx >= tx1 && key.tx <= tx2 &&
+            key.ty >= ty1 && key.ty <= ty2);
+  };
+
+  for (auto pt = tiles_.begin(); pt != tiles_.end(); ) {
+    const TileKey &key = (*pt).first;
+
+    bool used = (key.ids ? inView(key) : (*pt).second.used == frame_);
+
+    if ((*pt).second.image.isNull() && ! used) {
+      setWanted((*pt).first, 0);
+
+      pt = tiles_.erase(pt);
+    }
+    else
+      ++pt;
+  }
+
+  // render missing tiles nearest view centre first
+  double cx = (tx1 + tx2)/2.0, cy = (ty1 + ty2)/2.0;
+
+  std::sort(missing.begin(), missing.end(), [&](const TileKey &key1, const TileKey &key2) {
+    return std::hypot(key1.tx - cx, key1.ty - cy) < std::hypot(key2.tx - cx, key2.ty - cy);
+  });
+
+  for (const auto &key : missing)
+    requestTile(key);
+
+  return complete;
+}
+
+// get id of shape (-1 if none) at device pos of view with transform from the id tile
+// of the view level. Returns false if the id tile is not available (it is requested
+// and idsAdded is emitted when it is rendered)
+bool
+TileCache::
+shapeIdAt(const QTransform &transform, const QPointF &pos, int &shapeId)
+{
+  shapeId = -1;
+
+  // tiles must be for current model (prepared by draw)
+  if (! valid_ || model_->version() != version_)
+    return false;
+
+  int level = viewLevel(transform);
+
+  double scale = std::ldexp(tileScale_, level);
+
+  QPointF p = transform.inverted().map(pos);
+
+  double px = p.x()*scale, py = -p.y()*scale;
+
+  TileKey key { level, int(std::floor(px/tileSize)), int(std::floor(py/tileSize)), true };
+
+  auto pt = tiles_.find(key);
+
+  if (pt == tiles_.end()) {
+    requestTile(key);
+
+    return false;
+  }
+
+  const QImage &image = (*pt).second.image;
+
+  if (image.isNull())
+    return false;
+
+  (*pt).second.used = frame_;
+
+  int x = std::min(std::max(int(px - key.tx*double(tileSize)), 0), tileSize - 1);
+  int y = std::min(std::max(int(py - key.ty*double(tileSize)), 0), tileSize - 1);
+
+  shapeId = Model::colorId(image.pixel(x, y));
+
+  return true;
+}
+
+// get first level with at least resolution of view with transform
+int
+TileCache::
+viewLevel(const QTransform &transform) const
+{
+  double viewScale = std::sqrt(std::fabs(transform.determinant()));
+
+  return int(std::ceil(std::log2(viewScale/tileScale_) - 1E-6));
+}
+
+// draw part of a coarser tile scaled up for a missing tile
+bool
+TileCache::
+drawCoarser(QPainter *p, const QTransform &transform, const TileKey &key)
+{
+  for (int k = 1; k <= 4; ++k) {
+    int n = 1 << k;
+
+    TileKey key1 { key.level - k, floorDiv(key.tx, n), floorDiv(key.ty, n) };
+
+    auto pt = tiles_.find(key1);
+
+    if (pt == tiles_.end() || (*pt).second.image.isNull()) continue;
+
+    (*pt).second.used = frame_;
+
+    double size = double(tileSize)/n;
+
+    QRectF source((key.tx - key1.tx*n)*size, (key.ty - key1.ty*n)*size, size, size);
+
+    p->drawImage(tileTarget(transform, key), (*pt).second.image, source);
+
+    return true;
+  }
+
+  return false;
+}
+
+// add tile (as being rendered) and queue its rendering. Tiles requested by later draws
+// have higher priority so the latest view is rendered first (id tiles, needed for
+// picking, before its image tiles)
+void
+TileCache::
+requestTile(const TileKey &key)
+{
+  Tile &tile = tiles_[key];
+
+  tile         = Tile();
+  tile.used    = frame_;
+  tile.request = frame_;
+
+  setWanted(key, frame_);
+
+  uint frame = frame_ + (key.ids ? 1 : 0);
+
+  int priority = int(std::min(frame, uint(std::numeric_limits<int>::max())));
+
+  pool_->start(new RenderTask(this, key, version_, dual_, generation_, frame_,
+                              tileTransform(key)), priority);
+}
+
+// set request tile is being rendered for (0 if not wanted)
+void
+TileCache::
+setWanted(const TileKey &key, uint request)
+{
+  QMutexLocker locker(&mutex_);
+
+  if (request)
+    wanted_[key] = request;
+  else
+    wanted_.erase(key);
+}
+
+// is tile still wanted for request (called from render threads)
+bool
+TileCache::
+isWanted(const TileKey &key, uint request)
+{
+  QMutexLocker locker(&mutex_);
+
+  auto pw = wanted_.find(key);
+
+  return (pw != wanted_.end() && (*pw).second == request);
+}
+
+// called (from render thread) when tile rendered. Tiles are added to the cache in the
+// GUI thread
+void
+TileCache::
+tileRendered(const RenderedTile &tile)
+{
+  QMutexLocker locker(&mutex_);
+
+  rendered_.push_back(tile);
+
+  if (rendered_.size() == 1)
+    QMetaObject::invokeMethod(this, "addRenderedTiles", Qt::QueuedConnection);
+}
+
+void
+TileCache::
+addRenderedTiles()
+{
+  RenderedTiles rendered;
+
+  {
+  QMutexLocker locker(&mutex_);
+
+  rendered.swap(rendered_);
+  }
+
+  bool added = false, addedIds = false;
+
+  for (const auto &tile : rendered) {
+    // skip tile of cleared cache
+    if (tile.generation != generation_) continue;
+
+    auto pt = tiles_.find(tile.key);
+
+    // keep tile which left the view while being rendered (least recently used)
+    if (pt == tiles_.end()) {
+      if (! tile.image.isNull())
+        tiles_[tile.key].image = tile.image;
+
+      continue;
+    }
+
+    if (! (*pt).second.image.isNull()) continue;
+
+    if (tile.image.isNull()) {
+      // not rendered so request again when next in view
+      if ((*pt).second.request == tile.request) {
+        setWanted(tile.key, 0);
+
+        tiles_.erase(pt);
+      }
+
+      continue;
+    }
+
+    // (tile may have been rendered for an earlier request of it)
+    setWanted(tile.key, 0);
+
+    (*pt).second.image = tile.image;
+
+    if (tile.key.ids)
+      addedIds = true;
+    else
+      added = true;
+  }
+
+  removeOldTiles();
+
+  if (added)
+    emit tilesAdded();
+
+  if (addedIds)
+    emit idsAdded();
+}
+
+// remove least recently drawn tiles (not being rendered) above maximum
+void
+TileCache::
+removeOldTiles()
+{
+  int n = int(tiles_.size()) - maxTiles();
+  if (n <= 0) return;
+
+  std::vector<Tiles::iterator> old;
+
+  for (auto pt = tiles_.begin(); pt != tiles_.end(); ++pt) {
+    if (! (*pt).second.image.isNull() && (*pt).second.used != frame_)
+      old.push_back(pt);
+  }
+
+  std::sort(old.begin(), old.end(), [](const Tiles::iterator &pt1, const Tiles::iterator &pt2) {
+    return (*pt1).second.used < (*pt2).second.used;
+  });
+
+  for (int i = 0; i < n && i < int(old.size()); ++i)
+    tiles_.erase(old[uint(i)]);
+}
+
+// get transform from model to tile image
+QTransform
+TileCache::
+tileTransform(const TileKey &key) const
+{
+  double scale = std::ldexp(tileScale_, key.level);
+
+  return QTransform(scale, 0, 0, -scale, -key.tx*double(tileSize), -key.ty*double(tileSize));
+}
+
+// get device rect of tile in view (rounded so adjacent tiles share edges)
+QRectF
+TileCache::
+tileTarget(const QTransform &transform, const TileKey &key) const
+{
+  double size = tileSize/std::ldexp(tileScale_, key.level);
+
+  QRectF rect(key.tx*size, -(key.ty + 1)*size, size, size);
+
+  QRectF target = transform.mapRect(rect);
+
+  return QRectF(QPointF(std::round(target.left ()), std::round(target.top   ())),
+                QPointF(std::round(target.right()), std::round(target.bottom())));
+}
+
+//------
+
+Canvas::
+Canvas(QWidget *parent) :
+ QWidget(parent), modelNum_(9), repeatCount_(0), printSize_(1024, 1024),
+ imageComplete_(false), hoverShape_(-1), panning_(false)
+{
+  setMouseTracking(true);
+
+  model_ = new Model;
+
+  renderer_ = new Renderer(model_);
+
+  connect(model_, SIGNAL(changed()), this, SLOT(update()));
+
+  tileCache_ = new TileCache(model_, this);
+
+  connect(tileCache_, SIGNAL(tilesAdded()), this, SLOT(update()));
+  connect(tileCache_, SIGNAL(idsAdded()), this, SLOT(updateHover()));
+
+  addShapes(modelNum_);
+}
+
+Canvas::
+~Canvas()
+{
+  // stop tile rendering before model is deleted
+  delete tileCache_;
+
+  delete renderer_;
+  delete model_;
+}
+
+void
+Canvas::
+addShapes(int id)
+{
+  model_->build(id, repeatCount());
+}
+
+void
+Canvas::
+setModelNum(int n)
+{
+  if (n == modelNum_) return;
+
+  modelNum_ = n;
+
+  addShapes(modelNum_);
+
+  update();
+}
+
+void
+Canvas::
+setScale(double s)
+{
+  renderer_->setScale(s);
+
+  update();
+}
+
+void
+Canvas::
+setRepeatCount(int n)
+{
+  if (n == repeatCount_) return;
+
+  repeatCount_ = n;
+
+  addShapes(modelNum_);
+
+  update();
+}
+
+bool
+Canvas::
+latticeRepeat() const
+{
+  return model_->latticeRepeat();
+}
+
+void
+Canvas::
+setLatticeRepeat(bool b)
+{
+  if (b == latticeRepeat()) return;
+
+  model_->setLatticeRepeat(b);
+
+  addShapes(modelNum_);
+
+  update();
+}
+
+void
 Canvas::
-Canvas(QWidget *parent) :
- QWidget(parent), modelNum_(9), scale_(1.0), repeatCount_(0), dual_(false),
- printSize_(1024, 1024)
+setDual(bool b)
 {
-  model_ = new Model(this);
+  if (b == dual()) return;
 
-  addShapes(modelNum_);
+  renderer_->setDual(b);
+
+  update();
 }
 
+void
 Canvas::
-~Canvas()
+addPropeties(CQPropertyTree *tree)
 {
-  delete model_;
+  auto *iedit = new CQPropertyIntegerEditor;
+
+  tree->addProperty("Canvas", this, "modelNum"     )->setEditorFactory(iedit);
+  tree->addProperty("Canvas", this, "scale"        );
+  tree->addProperty("Canvas", this, "repeatCount"  )->setEditorFactory(iedit);
+  tree->addProperty("Canvas", this, "latticeRepeat");
+  tree->addProperty("Canvas", this, "dual"         );
+  tree->addProperty("Canvas", this, "printSize"    );
+
+  tree->addProperty("Model" , model_, "margin"     );
+  tree->addProperty("Model" , model_, "showSides"  );
+  tree->addProperty("Model" , model_, "bgColor"    );
+  tree->addProperty("Model" , model_, "borderColor");
+  tree->addProperty("Model" , model_, "borderWidth");
+  tree->addProperty("Model" , model_, "batchDraw"  );
+  tree->addProperty("Model" , model_, "lodDraw"    );
 }
 
+// draw cached image of model, redrawing it from tiles if the model, view or style have
+// changed or it is waiting for tiles
 void
 Canvas::
-addShapes(int id)
+paintEvent(QPaintEvent *)
 {
-  model_->reset();
-
-  if      (id == 0) {
-    auto shapeId = model_->addShape(6);
+  QPainter p(this);
 
-    auto shapeIds1 = model_->addShapesToSides({shapeId}, range(6), 3);
-    auto shapeIds2 = model_->addShapesToSides(shapeIds1, {1}     , 6);
+  ImageKey key = imageKey();
 
-    model_->repeat(repeatCount());
-  }
-  else if (id == 1) {
-    auto shapeId = model_->addShape(12);
+  // renderer transform may have been changed by print
+  renderer_->updateTransform(key.size.width(), key.size.height());
 
-    auto shapeIds1 = model_->addShapesToSides({shapeId}, rangeBy(0, 12, 2), 6);
-    auto shapeIds2 = model_->addShapesToSides({shapeId}, rangeBy(1, 12, 2), 4);
-    auto shapeIds3 = model_->addShapesToSides(shapeIds2, {2}              , 12);
+  if (image_.isNull() || ! imageComplete_ || ! imageKey_.equals(key))
+    updateImage(key);
 
-    model_->repeat(repeatCount());
-  }
-  else if (id == 2) {
-    auto shapeId = model_->addShape(4);
+  p.drawImage(QRectF(rect()), image_, QRectF(image_.rect()));
 
-    auto shapeIds1 = model_->addShapesToSides({shapeId}, range(4), 3);
-    auto shapeIds2 = model_->addShapesToSides(shapeIds1, {1}     , 4);
-    auto shapeIds3 = model_->addShapesToSides(shapeIds2, {2, 3}  , 3);
-    auto shapeIds4 = model_->addShapesToSides(shapeIds3, {2}     , 4);
+  // outline shape under mouse (renderer transform is for image pixels)
+  if (hoverShape_ >= 0 && hoverShape_ < model_->numShapes()) {
+    QTransform scale = QTransform::fromScale(width ()/double(image_.width ()),
+                                             height()/double(image_.height()));
 
-    model_->repeat(repeatCount());
-  }
-  else if (id == 3) {
-    auto shapeId = model_->addShape(6);
+    p.setTransform(renderer_->transform()*scale);
 
-    auto shapeIds1 = model_->addShapesToSides({shapeId}, range(6), 3);
-    auto shapeIds2 = model_->addShapesToSides(shapeIds1, {1}     , 3);
-    auto shapeIds3 = model_->addShapesToSides(shapeIds1, {2}     , 3);
-    auto shapeIds4 = model_->addShapesToSides(shapeIds3, {1}     , 6);
+    QPen pen(QColor(255, 255, 0), 2.0);
 
-    model_->repeat(repeatCount());
-  }
-  else if (id == 4) {
-    auto shapeId = model_->addShape(8);
+    pen.setCosmetic(true);
 
-    auto shapeIds1 = model_->addShapesToSides({shapeId}, rangeBy(1, 8, 2), 4);
-    auto shapeIds2 = model_->addShapesToSides(shapeIds1, {1}             , 8);
+    p.setPen  (pen);
+    p.setBrush(Qt::NoBrush);
 
-    model_->repeat(repeatCount());
+    p.drawPolygon(model_->getShape(hoverShape_)->insetPolygon());
   }
-  else if (id == 5) {
-    auto shapeId = model_->addShape(12);
+}
 
-    auto shapeIds1 = model_->addShapesToSides({shapeId}, rangeBy(0, 12, 2), 3);
-    auto shapeIds2 = model_->addShapesToSides({shapeId}, rangeBy(1, 12, 2), 4);
-    auto shapeIds3 = model_->addShapesToSides(shapeIds2, {1, 3}           , 3);
-    auto shapeIds4 = model_->addShapesToSides(shapeIds2, {2}              , 12);
+// get state the cached image depends on
+Canvas::ImageKey
+Canvas::
+imageKey() const
+{
+  ImageKey key;
 
-    model_->repeat(repeatCount());
-  }
-  else if (id == 6) {
-    auto shapeId = model_->addShape(6);
+  key.modelVersion = model_->version();
+  key.scale        = scale();
+  key.center       = renderer_->center();
+  key.dual         = dual();
+  key.dpr          = devicePixelRatioF();
+  key.size         = QSize(int(width()*key.dpr), int(height()*key.dpr));
 
-    auto shapeIds1 = model_->addShapesToSides({shapeId}, range(6), 4);
-    auto shapeIds2 = model_->addShapesToSides(shapeIds1, {1}     , 3);
-    auto shapeIds3 = model_->addShapesToSides(shapeIds1, {2}     , 6);
+  return key;
+}
 
-    model_->repeat(repeatCount());
-  }
-  else if (id == 7) {
-    auto shapeId = model_->addShape(4);
+// draw model to cached image (in device pixels) from tiles
+void
+Canvas::
+updateImage(const ImageKey &key)
+{
+  if (image_.size() != key.size)
+    image_ = QImage(key.size, QImage::Format_ARGB32_Premultiplied);
 
-    auto shapeIds1 = model_->addShapesToSides({shapeId}, {0, 2}, 4); shapeIds1.push_back(0);
-    auto shapeIds2 = model_->addShapesToSides(shapeIds1, {1, 3}, 3);
-    auto shapeIds3 = model_->addShapesToSides(shapeIds2, {1   }, 3);
-    auto shapeIds4 = model_->addShapesToSides(shapeIds3, {2   }, 4);
+  QPainter p(&image_);
 
-    model_->repeat(repeatCount());
-  }
-  else if (id == 8) {
-    auto shapeId = model_->addShape(3);
+  imageComplete_ = tileCache_->draw(&p, renderer_->transform(), key.dual);
 
-    auto shapeIds1 = model_->addShapesToSides({shapeId}, range(3), 3);
-    auto shapeIds2 = model_->addShapesToSides(shapeIds1, {1, 2}  , 3);
+  p.end();
 
-    model_->repeat(repeatCount());
-  }
-  else if (id == 9) {
-    auto shapeId = model_->addShape(5);
+  // shape ids change when model is rebuilt
+  if (key.modelVersion != imageKey_.modelVersion)
+    hoverShape_ = -1;
 
-    auto shapeIds1 = model_->addShapesToSides({shapeId}, range(5), 4);
+  imageKey_ = key;
+}
 
-    for (auto i : range(8)) {
-      assert(i >= 0);
-      auto shapeIds2 = model_->addShapesToSides(shapeIds1, {2}, 5);
-           shapeIds1 = model_->addShapesToSides(shapeIds2, {2}, 4);
-    }
-  }
-  else if (id == 10) {
-    auto shapeId = model_->addShape(6);
+// get shape under widget position from the id tiles of the cached image view. Valid is
+// false if the image is out of date or the id tile is still being rendered
+Shape *
+Canvas::
+shapeAt(const QPoint &pos, bool *valid)
+{
+  if (valid) *valid = false;
 
-    auto shapeIds1 = model_->addShapesToSides({shapeId}, range(6), 4);
-    auto shapeIds2 = model_->addShapesToSides(shapeIds1, {2}     , 3);
-    auto shapeIds3 = model_->addShapesToSides(shapeIds2, {1}     , 4);
-    auto shapeIds4 = model_->addShapesToSides(shapeIds2, {2}     , 4);
-    auto shapeIds5 = model_->addShapesToSides(shapeIds4, {2}     , 6);
+  if (image_.isNull() || imageKey_.modelVersion != model_->version())
+    return nullptr;
 
-    (void) model_->addShapesToSides(shapeIds1, {1}, 3);
-    (void) model_->addShapesToSides(shapeIds3, {1}, 3);
+  // renderer transform is for image pixels (image may be scaled to widget)
+  renderer_->updateTransform(image_.width(), image_.height());
 
-    model_->repeat(repeatCount());
-  }
-  else if (id == 11) {
-    auto shapeId = model_->addShape(8);
+  QPointF p(pos.x()*image_.width ()/double(width ()),
+            pos.y()*image_.height()/double(height()));
 
-    auto shapeIds1 = model_->addShapesToSides({shapeId}, rangeBy(0, 8, 2), 6);
-    auto shapeIds2 = model_->addShapesToSides(shapeIds1, {3}             , 8);
+  int shapeId;
 
-    model_->repeat(repeatCount());
-  }
-  else if (id == 12) {
-    auto shapeId = model_->addShape(12);
+  if (! tileCache_->shapeIdAt(renderer_->transform(), p, shapeId))
+    return nullptr;
 
-    auto shapeIds1 = model_->addShapesToSides({shapeId}, rangeBy(0, 12, 2), 3);
-    auto shapeIds2 = model_->addShapesToSides({shapeId}, rangeBy(1, 12, 2), 12);
+  if (valid) *valid = true;
 
-    model_->repeat(repeatCount());
-  }
+  if (shapeId < 0 || shapeId >= model_->numShapes())
+    return nullptr;
+
+  return model_->getShape(shapeId);
 }
 
 void
 Canvas::
-setModelNum(int n)
+paint(QPainter *p)
 {
-  if (n == modelNum_) return;
-
-  modelNum_ = n;
-
-  addShapes(modelNum_);
-
-  update();
+  renderer_->paint(p);
 }
 
 void
 Canvas::
-setScale(double s)
+mousePressEvent(QMouseEvent *e)
 {
-  scale_ = s;
-
-  update();
+  if (e->button() == Qt::LeftButton) {
+    panning_ = true;
+    panPos_  = e->pos();
+  }
 }
 
 void
 Canvas::
-setRepeatCount(int n)
+mouseMoveEvent(QMouseEvent *e)
 {
-  if (n == repeatCount_) return;
+  // move model point under last position to mouse (renderer transform is for image
+  // pixels)
+  if (panning_) {
+    double dpr = imageKey_.dpr;
 
-  repeatCount_ = n;
+    auto p1 = renderer_->itransform().map(dpr*QPointF(panPos_));
+    auto p2 = renderer_->itransform().map(dpr*QPointF(e->pos()));
 
-  addShapes(modelNum_);
+    renderer_->setCenter(renderer_->center() + p1 - p2);
 
-  update();
-}
+    panPos_ = e->pos();
 
-void
-Canvas::
-setDual(bool b)
-{
-  if (b == dual_) return;
+    update();
 
-  dual_ = b;
+    return;
+  }
 
-  update();
+  hoverPos_ = e->pos();
+
+  updateHover();
 }
 
+// update shape under mouse (kept while its id tile is rendered)
 void
 Canvas::
-addPropeties(CQPropertyTree *tree)
+updateHover()
 {
-  auto *iedit = new CQPropertyIntegerEditor;
+  if (panning_ || ! underMouse())
+    return;
 
-  tree->addProperty("Canvas", this, "modelNum"   )->setEditorFactory(iedit);
-  tree->addProperty("Canvas", this, "scale"      );
-  tree->addProperty("Canvas", this, "repeatCount")->setEditorFactory(iedit);
-  tree->addProperty("Canvas", this, "dual"       );
-  tree->addProperty("Canvas", this, "printSize"  );
+  bool valid;
 
-  tree->addProperty("Model" , model_, "margin"     );
-  tree->addProperty("Model" , model_, "showSides"  );
-  tree->addProperty("Model" , model_, "bgColor"    );
-  tree->addProperty("Model" , model_, "borderColor");
-  tree->addProperty("Model" , model_, "borderWidth");
-}
+  Shape *shape = shapeAt(hoverPos_, &valid);
 
-void
-Canvas::
-resizeEvent(QResizeEvent *)
-{
-  w_ = width ();
-  h_ = height();
+  if (! valid)
+    return;
+
+  int shapeId = (shape ? shape->id() : -1);
+
+  if (shapeId != hoverShape_) {
+    hoverShape_ = shapeId;
+
+    update();
+  }
 }
 
 void
 Canvas::
-paintEvent(QPaintEvent *)
+mouseReleaseEvent(QMouseEvent *e)
 {
-  QPainter p(this);
-
-  paint(&p);
+  if (e->button() == Qt::LeftButton)
+    panning_ = false;
 }
 
+// zoom by 2^(1/4) per wheel step keeping model point under mouse fixed
 void
 Canvas::
-paint(QPainter *p)
+wheelEvent(QWheelEvent *e)
 {
-  w_ = p->device()->width ();
-  h_ = p->device()->height();
+  double dpr = devicePixelRatioF();
 
-  p->setRenderHints(QPainter::Antialiasing | QPainter::TextAntialiasing);
+  int w = int(width()*dpr), h = int(height()*dpr);
 
-  p->fillRect(QRect(0, 0, w_, h_), QBrush(model_->bgColor()));
+  QPointF pos = dpr*e->position();
 
-  auto r = model_->getBBox();
+  renderer_->updateTransform(w, h);
 
-  double s = std::max(r.width(), r.height());
+  auto p1 = renderer_->itransform().map(pos);
 
-  transform_.reset();
+  renderer_->setScale(scale()*std::pow(2.0, e->angleDelta().y()/480.0));
 
-  transform_.scale    (w_/s, h_/s);
-  transform_.translate(s/2.0, s/2.0);
-  transform_.scale    (scale(), -scale());
+  renderer_->updateTransform(w, h);
 
-  p->setTransform(transform_);
+  auto p2 = renderer_->itransform().map(pos);
 
-  itransform_ = transform_.inverted();
+  renderer_->setCenter(renderer_->center() + p1 - p2);
 
-  model_->draw(p);
+  update();
 }
 
 void
 Canvas::
-mouseMoveEvent(QMouseEvent *)
+leaveEvent(QEvent *)
 {
+  if (hoverShape_ >= 0) {
+    hoverShape_ = -1;
+
+    update();
+  }
 }
 
 bool
@@ -897,12 +3036,28 @@ event(QEvent *e)
   if (e->type() == QEvent::ToolTip) {
     auto *helpEvent = static_cast<QHelpEvent *>(e);
 
-    auto p = itransform_.map(QPointF(helpEvent->pos()));
+    // renderer transform is for cached image (device pixels)
+    double dpr = imageKey_.dpr;
+
+    bool valid;
 
-    Shape *shape = model_->getShapeAtPos(p);
+    Shape *shape = shapeAt(helpEvent->pos(), &valid);
+
+    // id tiles out of date or not rendered so search model
+    if (! valid) {
+      auto p = renderer_->itransform().map(dpr*QPointF(helpEvent->pos()));
+
+      shape = model_->getShapeAtPos(p);
+
+      // point in margin between shapes so use nearest shape
+      if (! shape)
+        shape = model_->getNearestShape(p, 2*model_->margin());
+    }
 
     if (shape) {
-      auto rect = transform_.mapRect(shape->getBBox());
+      auto rect = renderer_->transform().mapRect(shape->getBBox());
+
+      rect = QRectF(rect.topLeft()/dpr, rect.size()/dpr);
 
       QToolTip::showText(helpEvent->globalPos(), shape->tip(), this, rect.toRect());
     }
@@ -976,9 +3131,382 @@ Dialog()
 
 //------
 
+// render images from command line options without creating any widgets
+//
+// options apply to all following -output options so several images can be rendered
+// by one process:
+//   -modelNum <n> -repeatCount <n> -scale <r> -margin <r> -dual <0|1>
+//   -batchDraw <0|1> -lodDraw <0|1> -printSize <w>x<h> -output <file>
+static int
+renderImages(int argc, char **argv)
+{
+  QElapsedTimer timer;
+
+  timer.start();
+
+  // no display is needed to render to an image
+  if (! qEnvironmentVariableIsSet("QT_QPA_PLATFORM"))
+    qputenv("QT_QPA_PLATFORM", "offscreen");
+
+  QGuiApplication app(argc, argv);
+
+  std::cout << "startup " << timer.nsecsElapsed()/1E6 << " ms" << std::endl;
+
+  Model    model;
+  Renderer renderer(&model);
+
+  int   modelNum    = 9;
+  int   repeatCount = 0;
+  QSize printSize(1024, 1024);
+
+  int buildModelNum    = -1;
+  int buildRepeatCount = -1;
+
+  auto toReal = [](const char *str, double &r) {
+    char *end;
+
+    r = strtod(str, &end);
+
+    return (end != str && *end == '\0');
+  };
+
+  auto toInt = [](const char *str, int &i) {
+    char *end;
+
+    i = int(strtol(str, &end, 10));
+
+    return (end != str && *end == '\0');
+  };
+
+  auto toSize = [](const char *str, QSize &s) {
+    int w, h;
+
+    if (sscanf(str, "%dx%d", &w, &h) != 2 || w <= 0 || h <= 0)
+      return false;
+
+    s = QSize(w, h);
+
+    return true;
+  };
+
+  for (int i = 1; i < argc; ++i) {
+    std::string opt = argv[i];
+
+    if (i + 1 >= argc) {
+      std::cerr << "Missing value for '" << opt << "'" << std::endl;
+      return 1;
+    }
+
+    const char *arg = argv[++i];
+
+    bool   ok = true;
+    int    n  = 0;
+    double r  = 0.0;
+
+    if      (opt == "-modelNum")
+      ok = toInt(arg, modelNum);
+    else if (opt == "-repeatCount")
+      ok = toInt(arg, repeatCount);
+    else if (opt == "-scale") {
+      if ((ok = toReal(arg, r)))
+        renderer.setScale(r);
+    }
+    else if (opt == "-margin") {
+      if ((ok = toReal(arg, r)))
+        model.setMargin(r);
+    }
+    else if (opt == "-dual") {
+      if ((ok = toInt(arg, n)))
+        renderer.setDual(n != 0);
+    }
+    else if (opt == "-batchDraw") {
+      if ((ok = toInt(arg, n)))
+        model.setBatchDraw(n != 0);
+    }
+    else if (opt == "-lodDraw") {
+      if ((ok = toInt(arg, n)))
+        model.setLodDraw(n != 0);
+    }
+    else if (opt == "-printSize")
+      ok = toSize(arg, printSize);
+    else if (opt == "-output") {
+      // only rebuild model if changed since last image
+      timer.restart();
+
+      if (modelNum != buildModelNum || repeatCount != buildRepeatCount) {
+        model.build(modelNum, repeatCount);
+
+        buildModelNum    = modelNum;
+        buildRepeatCount = repeatCount;
+      }
+
+      double buildTime = timer.nsecsElapsed()/1E6;
+
+      timer.restart();
+
+      QImage image(printSize, QImage::Format_ARGB32);
+
+      QPainter p(&image);
+
+      renderer.paint(&p);
+
+      p.end();
+
+      double renderTime = timer.nsecsElapsed()/1E6;
+
+      timer.restart();
+
+      bool saved = image.save(arg);
+
+      double saveTime = timer.nsecsElapsed()/1E6;
+
+      std::cout << arg << ": modelNum " << modelNum << " repeatCount " << repeatCount <<
+                   " shapes " << model.numShapes() << " build " << buildTime << " ms" <<
+                   " render " << renderTime << " ms save " << saveTime << " ms" << std::endl;
+
+      if (! saved) {
+        std::cerr << "Failed to save '" << arg << "'" << std::endl;
+        return 1;
+      }
+    }
+    else {
+      std::cerr << "Invalid option '" << opt << "'" << std::endl;
+      return 1;
+    }
+
+    if (! ok) {
+      std::cerr << "Invalid value '" << arg << "' for '" << opt << "'" << std::endl;
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+// time adding all shapes of model to a new shape index and finding the shape at each
+// point (as Model::getShapeAtPos)
+template<typename INDEX>
+static void
+timeShapeIndex(const Model &model, const std::vector<QPointF> &points,
+               double &addTime, double &queryTime, int &numFound)
+{
+  QElapsedTimer timer;
+
+  timer.start();
+
+  INDEX index(Rect(-100, -100, 100, 100));
+
+  for (int shapeId = 0; shapeId < model.numShapes(); ++shapeId)
+    index.add(model.getShape(shapeId));
+
+  addTime = timer.nsecsElapsed()/1E6;
+
+  timer.restart();
+
+  typename INDEX::DataList shapes;
+
+  numFound = 0;
+
+  for (const auto &p : points) {
+    index.getDataAtPoint(p.x(), p.y(), shapes);
+
+    for (auto shape : shapes) {
+      if (shape->contains(p, /*inner*/false)) {
+        ++numFound;
+        break;
+      }
+    }
+  }
+
+  queryTime = timer.nsecsElapsed()/1E6;
+}
+
+// time build of each built-in model for a range of repeat counts and print results
+// as CSV (or JSON with -json). Each build is run -iterations times and the fastest kept.
+// With -index the quad tree and hash grid shape indices are compared instead using the
+// shape centres and side probe points of each model as lookups
+//   -bench [-index] [-modelNum <n>] [-maxRepeat <n>] [-iterations <n>] [-json]
+static int
+benchModels(int argc, char **argv)
+{
+  QCoreApplication app(argc, argv);
+
+  int  modelNum   = -1;
+  int  maxRepeat  = 6;
+  int  iterations = 3;
+  bool json       = false;
+  bool index      = false;
+
+  for (int i = 1; i < argc; ++i) {
+    std::string opt = argv[i];
+
+    if      (opt == "-bench")
+      continue;
+    else if (opt == "-json")
+      json = true;
+    else if (opt == "-index")
+      index = true;
+    else if (opt == "-modelNum" || opt == "-maxRepeat" || opt == "-iterations") {
+      char *end = nullptr;
+
+      int n = (i + 1 < argc ? int(strtol(argv[i + 1], &end, 10)) : -1);
+
+      if (! end || end == argv[i + 1] || *end != '\0' || n < 0) {
+        std::cerr << "Invalid value for '" << opt << "'" << std::endl;
+        return 1;
+      }
+
+      ++i;
+
+      if      (opt == "-modelNum"  ) modelNum   = n;
+      else if (opt == "-maxRepeat" ) maxRepeat  = n;
+      else if (opt == "-iterations") iterations = std::max(n, 1);
+    }
+    else {
+      std::cerr << "Invalid option '" << opt << "'" << std::endl;
+      return 1;
+    }
+  }
+
+  std::vector<std::string> fields;
+
+  if (! index)
+    fields = { "model", "repeatCount", "shapes", "peakShapes", "wallMs", "addShapeMs",
+               "addShapesToSidesMs", "repeatMs", "updateShapeSidesMs", "shapesPerSec" };
+  else
+    fields = { "model", "repeatCount", "shapes", "lookups", "quadTreeAddMs",
+               "quadTreeLookupMs", "quadTreeFound", "hashGridAddMs", "hashGridLookupMs",
+               "hashGridFound" };
+
+  if (json)
+    std::cout << "[" << std::endl;
+  else {
+    for (std::size_t i = 0; i < fields.size(); ++i)
+      std::cout << (i > 0 ? "," : "") << fields[i];
+
+    std::cout << std::endl;
+  }
+
+  Model model;
+
+  QElapsedTimer timer;
+
+  bool first = true;
+
+  for (int id = 0; id <= 12; ++id) {
+    if (modelNum >= 0 && id != modelNum)
+      continue;
+
+    for (int repeatCount = 0; repeatCount <= maxRepeat; ++repeatCount) {
+      std::vector<double> values;
+
+      if (! index) {
+        double            wallTime = -1.0;
+        Model::BuildStats stats;
+        int               numShapes = 0;
+
+        for (int i = 0; i < iterations; ++i) {
+          timer.start();
+
+          model.build(id, repeatCount);
+
+          double t = timer.nsecsElapsed()/1E6;
+
+          if (wallTime < 0.0 || t < wallTime) {
+            wallTime  = t;
+            stats     = model.buildStats();
+            numShapes = model.numShapes();
+          }
+        }
+
+        double shapesPerSec = (wallTime > 0.0 ? 1000.0*numShapes/wallTime : 0.0);
+
+        values = {
+          double(id), double(repeatCount), double(numShapes), double(stats.peakShapes),
+          wallTime, stats.addShapeTime, stats.addShapesToSidesTime, stats.repeatTime,
+          stats.updateShapeSidesTime, shapesPerSec
+        };
+      }
+      else {
+        model.build(id, repeatCount);
+
+        std::vector<QPointF> points;
+
+        for (int shapeId = 0; shapeId < model.numShapes(); ++shapeId) {
+          Shape *shape = model.getShape(shapeId);
+
+          points.push_back(shape->pos());
+
+          for (int i = 0; i < shape->numSides(); ++i) {
+            Side side = shape->side(i);
+
+            points.push_back(side.mid() + Shape::sideProbeOffset()*side.vector(shape->pos()));
+          }
+        }
+
+        double addTime[2]   = { -1.0, -1.0 };
+        double queryTime[2] = { -1.0, -1.0 };
+        int    numFound[2]  = { 0, 0 };
+
+        for (int i = 0; i < iterations; ++i) {
+          double addTime1, queryTime1;
+
+          timeShapeIndex<ShapeQuadTree>(model, points, addTime1, queryTime1, numFound[0]);
+
+          if (addTime  [0] < 0.0 || addTime1   < addTime  [0]) addTime  [0] = addTime1;
+          if (queryTime[0] < 0.0 || queryTime1 < queryTime[0]) queryTime[0] = queryTime1;
+
+          timeShapeIndex<ShapeHashGrid>(model, points, addTime1, queryTime1, numFound[1]);
+
+          if (addTime  [1] < 0.0 || addTime1   < addTime  [1]) addTime  [1] = addTime1;
+          if (queryTime[1] < 0.0 || queryTime1 < queryTime[1]) queryTime[1] = queryTime1;
+        }
+
+        values = {
+          double(id), double(repeatCount), double(model.numShapes()), double(points.size()),
+          addTime[0], queryTime[0], double(numFound[0]),
+          addTime[1], queryTime[1], double(numFound[1])
+        };
+      }
+
+      if (json) {
+        std::cout << (first ? "" : ",\n") << "  {";
+
+        for (std::size_t i = 0; i < fields.size(); ++i)
+          std::cout << (i > 0 ? ", " : "") << "\"" << fields[i] << "\": " << values[i];
+
+        std::cout << "}";
+      }
+      else {
+        for (std::size_t i = 0; i < fields.size(); ++i)
+          std::cout << (i > 0 ? "," : "") << values[i];
+
+        std::cout << std::endl;
+      }
+
+      first = false;
+    }
+  }
+
+  if (json)
+    std::cout << (first ? "" : "\n") << "]" << std::endl;
+
+  return 0;
+}
+
 int
 main(int argc, char **argv)
 {
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "-bench") == 0)
+      return benchModels(argc, argv);
+  }
+
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "-output") == 0)
+      return renderImages(argc, argv);
+  }
+
   QApplication app(argc, argv);
 
   Dialog *dialog = new Dialog;
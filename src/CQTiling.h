@@ -2,14 +2,25 @@
 #define CQTiling_H
 
 #include <QWidget>
+#include <QPolygonF>
+#include <QPainterPath>
+#include <QStaticText>
+#include <QFont>
+#include <QReadWriteLock>
+#include <QMutex>
 #include <CQuadTree.h>
-#include <PointSet.h>
+#include <CHashGrid.h>
+#include <CVertexIndex.h>
+#include <CHalfEdgeMesh.h>
+#include <CArena.h>
+#include <map>
 
 class CQPropertyTree;
 
 class QPainter;
+class QThreadPool;
 
-class Canvas;
+class Model;
 class Shape;
 class Side;
 
@@ -47,6 +58,14 @@ class Rect : public QRectF {
 };
 
 typedef CQuadTree<Shape, Rect> ShapeQuadTree;
+typedef CHashGrid<Shape, Rect> ShapeHashGrid;
+
+// spatial index used to find shapes (define CQTILING_HASH_GRID to use hash grid)
+#ifdef CQTILING_HASH_GRID
+typedef ShapeHashGrid ShapeIndex;
+#else
+typedef ShapeQuadTree ShapeIndex;
+#endif
 
 namespace ModelUtil {
 
@@ -90,6 +109,181 @@ inline std::vector<int> rangeBy(int i1, int i2, int s=1) {
 
 //---
 
+// lattice of integer combinations of (up to) two basis vectors
+class Lattice {
+ public:
+  Lattice() :
+   rank_(0) {
+  }
+
+  // calculate basis of the lattice generated by vectors
+  // (fails if the vectors are not commensurate)
+  bool init(const std::vector<QPointF> &vectors);
+
+  int rank() const { return rank_; }
+
+  const QPointF &basis(int i) const { return basis_[i]; }
+
+  // get integer coordinates of v (fails if v is not a lattice vector)
+  bool coords(const QPointF &v, int &i, int &j) const;
+
+  QPointF point(int i, int j) const {
+    return i*basis_[0] + j*basis_[1];
+  }
+
+ private:
+  int     rank_;
+  QPointF basis_[2];
+};
+
+//---
+
+typedef std::pair<QPointF, QPointF> SideVector;
+
+//---
+
+struct ShapeSide {
+  int shapeId;
+  int sideNum;
+
+  ShapeSide(int shapeId1=-1, int sideNum1=-1) :
+   shapeId(shapeId1), sideNum(sideNum1) {
+  }
+
+  bool isValid() const { return shapeId >= 0; }
+};
+
+//---
+
+// view of side (num) of a shape stored in a Model
+class Side {
+ public:
+  Side(Model *model=nullptr, int shapeId=-1, int num=0);
+
+  Shape *shape() const;
+
+  int num() const { return num_; }
+
+  const QPointF &start() const;
+  const QPointF &end  () const;
+
+  bool hasShapeSide() const { return shapeSide().isValid(); }
+
+  const ShapeSide &shapeSide() const;
+
+  void setShapeSide(int shapeId, int sideNum);
+
+  double length() const {
+    return ModelUtil::dist(start(), end());
+  }
+
+  double angle() const {
+    QPointF d = end() - start();
+
+    return atan2(d.y(), d.x());
+  }
+
+  QPointF mid() const {
+    return (start() + end())/2.0;
+  }
+
+  QPointF vector(const QPointF &pos) const {
+    QPointF pv = mid() - pos;
+
+    return pv/ModelUtil::hypot(pv);
+  }
+
+  QRectF getBBox() const {
+    const QPointF &p1 = start();
+    const QPointF &p2 = end();
+
+    double x1 = std::min(p1.x(), p2.x());
+    double y1 = std::min(p1.y(), p2.y());
+    double x2 = std::max(p1.x(), p2.x());
+    double y2 = std::max(p1.y(), p2.y());
+
+    return QRectF(x1, y1, x2 - x1, y2 - y1);
+  }
+
+ private:
+  Model* model_;
+  int    shapeId_;
+  int    num_;
+  int    first_;
+  int    numSides_;
+};
+
+//---
+
+// view of shape (id) stored in a Model. The shape's data lives in the model's
+// arrays so a Shape is only a model pointer and an index
+class Shape {
+ public:
+  Shape(Model *model=nullptr, int id=-1);
+
+  int id() const { return id_; }
+
+  int numSides() const;
+
+  Side side(int sideNum) const { return Side(model_, id_, sideNum); }
+
+  const QColor &color() const;
+
+  const QPointF &pos() const;
+
+  const QPointF &vertex(int i) const;
+
+  Shape *dup() const;
+
+  void copyOver(Shape *shape);
+
+  void translate(const QPointF &p);
+
+  void scale(double s);
+
+  void rotate(double a);
+
+  const Rect &getBBox() const;
+
+  double angle() const;
+
+  bool contains(const QPointF &p, bool inner=true) const;
+
+  double distance(const QPointF &p) const;
+
+  void updateSides(bool openOnly=false);
+
+  // distance outside side mid point used to probe for adjacent shape
+  static double sideProbeOffset() { return 0.01; }
+
+  int getSide(const QPointF &p) const;
+
+  void addSideProbes(bool openOnly, std::vector<QPointF> &points, std::vector<int> &sideNums);
+
+  void linkSide(int sideNum, Shape *shape, const QPointF &p);
+
+  int numOccupied() const;
+
+  bool fullyOccupied() const { return numOccupied() == numSides(); }
+
+  QString tip() const;
+
+  QPolygonF insetPolygon() const;
+
+  // get drawn size (pixels) for pixel scale (pixels per model unit)
+  double pixelSize(double pixelScale) const;
+
+  void draw(QPainter *p) const;
+
+  void drawLabels(QPainter *p) const;
+
+ private:
+  Model* model_;
+  int    id_;
+};
+
+//---
+
 class Model : public QObject {
   Q_OBJECT
 
@@ -98,9 +292,29 @@ class Model : public QObject {
   Q_PROPERTY(QColor bgColor     READ bgColor     WRITE setBgColor    )
   Q_PROPERTY(QColor borderColor READ borderColor WRITE setBorderColor)
   Q_PROPERTY(double borderWidth READ borderWidth WRITE setBorderWidth)
+  Q_PROPERTY(bool   batchDraw   READ batchDraw   WRITE setBatchDraw  )
+  Q_PROPERTY(bool   lodDraw     READ lodDraw     WRITE setLodDraw    )
+
+ public:
+  // timings (ms) and sizes of the last build. Phase times do not include the time
+  // spent in updateShapeSides, which is reported separately
+  struct BuildStats {
+    double addShapeTime         { 0.0 };
+    double addShapesToSidesTime { 0.0 };
+    double repeatTime           { 0.0 };
+    double updateShapeSidesTime { 0.0 };
+    int    peakShapes           { 0 };
+  };
+
+  // shapes sharing each vertex
+  typedef CVertexIndex<QPointF, Shape *> Points;
+
+  // half-edge mesh of shapes. Face f is shape f, half-edge i of a face is side i and
+  // vertices are numbered as in Points
+  typedef CHalfEdgeMesh<QPointF> Mesh;
 
  public:
-  Model(Canvas *canvas);
+  Model(QObject *parent=nullptr);
  ~Model();
 
   double margin() const { return margin_; }
@@ -118,8 +332,24 @@ class Model : public QObject {
   double borderWidth() const { return borderWidth_; }
   void setBorderWidth(double w);
 
+  bool batchDraw() const { return batchDraw_; }
+  void setBatchDraw(bool b);
+
+  // simplify drawing of shapes which are small on screen
+  bool lodDraw() const { return lodDraw_; }
+  void setLodDraw(bool b);
+
+  // get version (changed whenever shapes or style change)
+  uint version() const { return version_; }
+
+  bool latticeRepeat() const { return latticeRepeat_; }
+  void setLatticeRepeat(bool b) { latticeRepeat_ = b; }
+
   void reset();
 
+  // build built-in model (id) with patch repeated repeatCount times
+  void build(int id, int repeatCount);
+
   int addShape(int numSides);
 
   std::vector<int> addShapesToSides(const std::vector<int> &shapeIds,
@@ -127,239 +357,352 @@ class Model : public QObject {
 
   void repeat(int depth);
 
+  const BuildStats &buildStats() const { return buildStats_; }
+
+  const Mesh &mesh();
+
+  const Mesh &dual();
+
+  // get mesh vertex of dual face
+  int dualVertex(int face) const { return dualVertex_[uint(face)]; }
+
   QRectF getBBox() const;
 
-  Shape *getShape(int shapeId) const { return shapes_[uint(shapeId)]; }
+  int numShapes() const { return int(shapes_.size()); }
+
+  Shape *getShape(int shapeId) const {
+    return const_cast<Shape *>(&shapes_[uint(shapeId)]);
+  }
+
+  Shape *getShapeAtPos(const QPointF &p, bool inner=true) const;
+
+  void getShapesAtPoints(const std::vector<QPointF> &points, std::vector<Shape *> &shapes,
+                         bool inner=true, bool parallel=false) const;
+
+  Shape *getNearestShape(const QPointF &p, double maxDist) const;
+
+  void getShapesInRect(const QRectF &rect, std::vector<int> &shapeIds) const;
+
+  // add sides of shapes (ascending ids) to path with sides shared by two of the shapes
+  // added once (e.g. for export of tiling edges)
+  void addEdgePath(const std::vector<int> &shapeIds, QPainterPath &path) const;
 
-  Shape *getShapeAtPos(const QPointF &p) const;
+  void draw(QPainter *p, bool dual, const QRectF &rect=QRectF(), bool retain=true);
 
-  void draw(QPainter *p);
+  void prepareDraw(bool dual);
 
-  void drawDual(QPainter *p, const QPointF &point, const std::set<Shape *> &shape);
+  // lock held for read by threads drawing the model and for write by build and setters
+  // while they change it
+  QReadWriteLock *drawLock() const { return &drawLock_; }
+
+  void drawDual(QPainter *p, int v) const;
+
+  // draw outer polygon of shapes touching rect in colour encoding shape id (for picking)
+  void drawIds(QPainter *p, const QRectF &rect);
+
+  static QColor idColor(int shapeId);
+  static int    colorId(QRgb rgb);
+
+ signals:
+  void changed();
 
  private:
+  friend class Shape;
+  friend class Side;
+
+  Shape *allocShape(int numSides);
+
   Shape *createShape(int numSides);
 
+  void discardShape(Shape *shape);
+
   void storeShape(Shape *shape);
 
-  void updateShapeSides();
+  void storeShapes(int firstId);
+
+  void updateShapeSides(Shape *shape, bool relink=false);
 
   void placeShape(Shape *shape, int sideNum, Shape *shape1);
 
+  bool repeatLattice(int depth);
+
+  void invalidateCaches();
+
+  void notifyChanged(QWriteLocker &locker);
+
+  const QPointF *insetVertices(int shapeId);
+
+  void updateInsetVertices();
+
+  // level of detail shape is drawn with (by drawn size)
+  enum class DrawLevel {
+    POINT,  // point of shape colour
+    FILL,   // filled polygon
+    BORDER, // filled polygon with border
+    LABELS  // filled polygon with border and side labels
+  };
+
+  DrawLevel drawLevel(const Shape *shape, double pixelScale, double labelPixels) const;
+
+  // shapes with the same colour drawn as a single path (with and without border) and
+  // as points
+  struct DrawBatch {
+    QColor       color;
+    QPainterPath path;
+    QPainterPath fillPath;
+    QPolygonF    points;
+  };
+
+  typedef std::vector<DrawBatch> DrawBatches;
+
+  void addDrawBatches(const std::vector<int> &shapeIds, double pixelScale,
+                      DrawBatches &batches, QPainterPath &edges,
+                      double &minScale, double &maxScale) const;
+  void drawBatches(QPainter *p, const DrawBatches &batches, const QPainterPath &edges) const;
+
+  void addDualBatch(const std::vector<int> &vertices, QPolygonF &points,
+                    QPainterPath &path) const;
+  void drawDualBatch(QPainter *p, const QPolygonF &points, const QPainterPath &path) const;
+
+  void drawLabels(QPainter *p, const std::vector<int> &shapeIds, double pixelScale,
+                  bool cache);
+
+  const QStaticText &labelText(int i, const QFont &font);
+
   void addShapeAtPos(Shape *shape);
 
  private:
-  typedef std::vector<Shape *>        Shapes;
+  typedef CArena<Shape>               Shapes;
   typedef std::vector<Shape *>        PosShapes;
-  typedef PointData<QPointF, Shape *> Points;
 
-  Canvas*       canvas_;
   double        margin_;
   bool          showSides_;
   QColor        bgColor_;
   QColor        borderColor_;
   double        borderWidth_;
+  bool          latticeRepeat_;
+  bool          batchDraw_ { true };
+  bool          lodDraw_   { true };
+  uint          version_   { 0 };
+  mutable QReadWriteLock drawLock_; // see drawLock
   Shapes        shapes_;
   PosShapes     posShapes_;
-  ShapeQuadTree shapeQuadTree_;
+
+  // shape data by shape id. Vertices and side links of a shape are stored from
+  // shapeVertex_[id] to shapeVertex_[id + 1] (side i goes from vertex i to i + 1)
+  std::vector<QPointF>   shapePos_;
+  std::vector<int>       shapeVertex_;
+  std::vector<int>       shapeOccupied_;
+  std::vector<Rect>      shapeBBox_;     // cached bbox (null if vertices changed)
+  std::vector<QPointF>   vertices_;
+  std::vector<ShapeSide> sideLinks_;
+
+  // shape vertices inset by margin (as drawn, indexed as vertices_)
+  std::vector<QPointF>   insetVertices_;
+  bool                   insetValid_ { false };
+
+  ShapeIndex    shapeIndex_;
+  QRectF        bbox_;       // union of shape bboxes (and unit square at origin)
   Points        points_;
+  Mesh          mesh_;
+  bool          meshValid_ { false };
+
+  // dual (Laves) tiling. Dual face i is around mesh vertex dualVertex_[i] and dual
+  // vertex j is the centre of shape j. Drawn polygons (dual faces inset towards their
+  // vertex) are kept with it
+  Mesh                     dual_;
+  std::vector<int>         dualVertex_;
+  std::vector<int>         dualFace_;   // dual face of mesh vertex (-1 if none)
+  std::vector<QPolygonF>   dualPolys_;
+  bool                     dualValid_ { false };
+
+  // retained draw batches of whole model (shapes and dual). Shape batches are valid
+  // for pixel scales from drawBatchesMinScale_ to drawBatchesMaxScale_ (where the
+  // level of detail of all shapes is unchanged)
+  DrawBatches   drawBatches_;
+  QPainterPath  drawEdges_;   // shared border edges (margin zero)
+  double        drawBatchesMinScale_ { 0.0 };
+  double        drawBatchesMaxScale_ { 0.0 };
+  QPolygonF     dualPoints_;
+  QPainterPath  dualPath_;
+  bool          drawBatchesValid_ { false };
+  bool          dualBatchValid_   { false };
+
+  // integer labels laid out for labelFont_ (label i is labelTexts_[i])
+  QFont                    labelFont_;
+  std::vector<QStaticText> labelTexts_;
+
+  // timings and sizes of last build
+  BuildStats    buildStats_;
 };
 
 //---
 
-typedef std::pair<QPointF, QPointF> SideVector;
-
-//---
-
-struct ShapeSide {
-  int shapeId;
-  int sideNum;
-
-  ShapeSide(int shapeId1=-1, int sideNum1=-1) :
-   shapeId(shapeId1), sideNum(sideNum1) {
-  }
+class Dialog : public QWidget {
+  Q_OBJECT
 
-  bool isValid() const { return shapeId >= 0; }
+ public:
+  Dialog();
 };
 
-//---
-
-class Side {
+// draws model scaled to fit the paint device (no widget required)
+class Renderer {
  public:
-  Side(Shape *shape, int num=0, const QPointF &start=QPointF(), const QPointF &end=QPointF()) :
-   shape_(shape), num_(num), start_(start), end_(end), shapeSide_(-1, -1) {
-  }
-
-  Shape *shape() const { return shape_; }
-
-  void setNum(int num) { num_ = num; }
-  int num() const { return num_; }
-
-  const QPointF &start() const { return start_; }
-  const QPointF &end  () const { return end_  ; }
-
-  Side *dup(Shape *shape) const {
-    Side *side = new Side(shape, num_, start_, end_);
-
-    return side;
-  }
-
-  bool hasShapeSide() const { return shapeSide_.isValid(); }
-
-  const ShapeSide &shapeSide() const { return shapeSide_; }
-
-  void setShapeSide(int shapeId, int sideNum) {
-    shapeSide_ = ShapeSide(shapeId, sideNum);
-  }
-
-  double length() const {
-    return ModelUtil::dist(start_, end_);
-  }
-
-  double angle() const {
-    QPointF d = end_ - start_;
-
-    return atan2(d.y(), d.x());
-  }
-
-  QPointF mid() const {
-    return (start_ + end_)/2.0;
-  }
+  Renderer(Model *model);
 
-  QPointF vector(const QPointF &pos) const {
-    QPointF pv = mid() - pos;
+  Model *model() const { return model_; }
 
-    return pv/ModelUtil::hypot(pv);
-  }
+  double scale() const { return scale_; }
+  void setScale(double s) { scale_ = s; }
 
-  void move(const QPointF &p) {
-    start_ += p;
-    end_   += p;
-  }
+  bool dual() const { return dual_; }
+  void setDual(bool b) { dual_ = b; }
 
-  void scale(const QPointF &o, double s) {
-    start_ = s*(start_ - o) + o;
-    end_   = s*(end_   - o) + o;
-  }
+  // model point at centre of device
+  const QPointF &center() const { return center_; }
+  void setCenter(const QPointF &c) { center_ = c; }
 
-  void rotate(const QPointF &o, double a) {
-    double s = sin(a);
-    double c = cos(a);
+  const QTransform &transform () const { return transform_ ; }
+  const QTransform &itransform() const { return itransform_; }
 
-    QPointF d1 = start_ - o;
-    QPointF d2 = end_   - o;
+  void updateTransform(int w, int h);
 
-    start_ = QPointF(d1.x()*c - d1.y()*s, d1.x()*s + d1.y()*c) + o;
-    end_   = QPointF(d2.x()*c - d2.y()*s, d2.x()*s + d2.y()*c) + o;
-  }
+  void paint(QPainter *p, const QRect &exposed=QRect());
 
-  QRectF getBBox() const {
-    double x1 = std::min(start_.x(), end_.x());
-    double y1 = std::min(start_.y(), end_.y());
-    double x2 = std::max(start_.x(), end_.x());
-    double y2 = std::max(start_.y(), end_.y());
+  static void paintModel(QPainter *p, Model *model, bool dual, const QTransform &transform,
+                         const QRect &exposed, bool retain);
 
-    return QRectF(x1, y1, x2 - x1, y2 - y1);
-  }
+  static void paintIds(QPainter *p, Model *model, const QTransform &transform);
 
  private:
-  Shape     *shape_;
-  int        num_;
-  QPointF    start_;
-  QPointF    end_;
-  ShapeSide  shapeSide_;
+  Model*     model_;
+  double     scale_;
+  bool       dual_;
+  QPointF    center_;
+  QTransform transform_;
+  QTransform itransform_;
 };
 
 //---
 
-class Shape : public QObject {
+// cache of model rendered to fixed size tiles at power of two zoom levels
+//
+// tile (level, tx, ty) is the tileSize square at (tx, ty)*tileSize of the model drawn
+// at tileScale*2^level pixels per unit (y up, scale at level 0 fits model to one
+// tile). A view is drawn from tiles of the first level with at least its resolution.
+// Missing tiles are drawn from coarser tiles while they are rendered by a thread pool
+// and tilesAdded is emitted when they are available. Requests for tiles which are no
+// longer in view are dropped and the tiles of the latest view are rendered first.
+// Tiles of shape ids (for picking) are rendered in the same way when first needed.
+// Tiles are discarded when the model version or dual flag change.
+class TileCache : public QObject {
   Q_OBJECT
 
  public:
-  typedef std::vector<Side *> Sides;
+  enum { tileSize = 256 };
 
  public:
-  Shape(Model *model, int numSides, const QColor &c);
- ~Shape();
+  TileCache(Model *model, QObject *parent=nullptr);
+ ~TileCache();
 
-  void setId(int id) { id_ = id; }
-  int id() const { return id_; }
+  // maximum number of cached tiles (least recently drawn are removed)
+  int maxTiles() const { return maxTiles_; }
+  void setMaxTiles(int n) { maxTiles_ = n; }
 
-  int numSides() const { return numSides_; }
+  bool draw(QPainter *p, const QTransform &transform, bool dual);
 
-  const Sides &sides() const { return sides_; }
+  bool shapeIdAt(const QTransform &transform, const QPointF &pos, int &shapeId);
 
-  const Side &side(int sideNum) const { return *sides_[uint(sideNum)]; }
-  Side &side(int sideNum) { return *sides_[uint(sideNum)]; }
+  void clear();
 
-  const QColor &color() const { return c_; }
+ signals:
+  void tilesAdded();
 
-  const QPointF &pos() const { return pos_; }
-
-  const QPolygonF &poly() const { return poly_; }
-
-  Shape *dup() const;
+  void idsAdded();
 
-  void copyOver(Shape *shape);
+ private slots:
+  void addRenderedTiles();
 
-  void translate(const QPointF &p);
+ private:
+  struct TileKey {
+    int  level { 0 };
+    int  tx    { 0 };
+    int  ty    { 0 };
+    bool ids   { false }; // shape ids tile
 
-  void scale(double s);
+    bool operator<(const TileKey &key) const {
+      if (ids   != key.ids  ) return ids   < key.ids;
+      if (level != key.level) return level < key.level;
+      if (ty    != key.ty   ) return ty    < key.ty;
+      return tx < key.tx;
+    }
+  };
 
-  void rotate(double a);
+  struct Tile {
+    QImage image; // rendered image (null while rendering)
+    uint   used    { 0 }; // frame tile was last drawn (or in view while rendering)
+    uint   request { 0 }; // frame tile was requested in
+  };
 
-  QRectF getBBox() const;
+  struct RenderedTile {
+    TileKey key;
+    uint    generation;
+    uint    request;
+    QImage  image; // null if not rendered (model changed or tile not wanted)
+  };
 
-  double angle() const;
+  class RenderTask;
 
-  bool contains(const QPointF &p) const;
+  int viewLevel(const QTransform &transform) const;
 
-  void updatePoly() const;
+  void requestTile(const TileKey &key);
 
-  void updateSides();
+  void setWanted(const TileKey &key, uint request);
 
-  int getSide(const QPointF &p) const;
+  bool isWanted(const TileKey &key, uint request);
 
-  int numOccupied() const { return numOccupied_; }
+  void tileRendered(const RenderedTile &tile);
 
-  bool fullyOccupied() const { return numOccupied_ == numSides_; }
+  QTransform tileTransform(const TileKey &key) const;
 
-  QString tip() const;
+  QRectF tileTarget(const QTransform &transform, const TileKey &key) const;
 
-  void draw(QPainter *p);
+  bool drawCoarser(QPainter *p, const QTransform &transform, const TileKey &key);
 
- private:
-  void addSides();
+  void removeOldTiles();
 
  private:
-  Model*            model_;
-  int               id_;
-  int               numSides_;
-  Sides             sides_;
-  int               numOccupied_;
-  QColor            c_;
-  QPointF           pos_;
-  mutable QPolygonF poly_;
-  mutable QPolygonF ipoly_;
+  typedef std::map<TileKey, Tile>  Tiles;
+  typedef std::map<TileKey, uint>  TileRequests;
+  typedef std::vector<RenderedTile> RenderedTiles;
+
+  Model*        model_;
+  QThreadPool*  pool_;
+  Tiles         tiles_;
+  bool          valid_      { false };
+  uint          version_    { 0 };     // model version of tiles
+  bool          dual_       { false };
+  uint          generation_ { 0 };     // changed when tiles cleared
+  double        tileScale_  { 1.0 };   // pixels per unit at level 0
+  uint          frame_      { 0 };     // number of draws
+  int           maxTiles_   { 512 };
+  QMutex        mutex_;                // lock for wanted_ and rendered_ (shared with
+                                       // render threads)
+  TileRequests  wanted_;               // request of each tile still to be rendered
+  RenderedTiles rendered_;             // rendered tiles waiting to be added
 };
 
 //---
 
-class Dialog : public QWidget {
-  Q_OBJECT
-
- public:
-  Dialog();
-};
-
 class Canvas : public QWidget {
   Q_OBJECT
 
-  Q_PROPERTY(int    modelNum    READ modelNum    WRITE setModelNum   )
-  Q_PROPERTY(double scale       READ scale       WRITE setScale      )
-  Q_PROPERTY(int    repeatCount READ repeatCount WRITE setRepeatCount)
-  Q_PROPERTY(bool   dual        READ dual        WRITE setDual       )
-  Q_PROPERTY(QSize  printSize   READ printSize   WRITE setPrintSize  )
+  Q_PROPERTY(int    modelNum      READ modelNum      WRITE setModelNum     )
+  Q_PROPERTY(double scale         READ scale         WRITE setScale        )
+  Q_PROPERTY(int    repeatCount   READ repeatCount   WRITE setRepeatCount  )
+  Q_PROPERTY(bool   latticeRepeat READ latticeRepeat WRITE setLatticeRepeat)
+  Q_PROPERTY(bool   dual          READ dual          WRITE setDual         )
+  Q_PROPERTY(QSize  printSize     READ printSize     WRITE setPrintSize    )
 
  public:
   Canvas(QWidget *parent=nullptr);
@@ -368,13 +711,16 @@ class Canvas : public QWidget {
   int modelNum() const { return modelNum_; }
   void setModelNum(int n);
 
-  double scale() const { return scale_; }
+  double scale() const { return renderer_->scale(); }
   void setScale(double s);
 
   int repeatCount() const { return repeatCount_; }
   void setRepeatCount(int n);
 
-  bool dual() const { return dual_; }
+  bool latticeRepeat() const;
+  void setLatticeRepeat(bool b);
+
+  bool dual() const { return renderer_->dual(); }
   void setDual(bool b);
 
   const QSize &printSize() const { return printSize_; }
@@ -387,27 +733,60 @@ class Canvas : public QWidget {
   void paint(QPainter *p);
 
  private:
-  void resizeEvent(QResizeEvent *) override;
+  // state cached image was rendered with
+  struct ImageKey {
+    uint    modelVersion { 0 };
+    double  scale        { 0.0 };
+    QPointF center;
+    bool    dual         { false };
+    QSize   size;
+    double  dpr          { 1.0 };
+
+    bool equals(const ImageKey &key) const {
+      return (modelVersion == key.modelVersion && scale == key.scale &&
+              center == key.center && dual == key.dual && size == key.size &&
+              dpr == key.dpr);
+    }
+  };
+
+  ImageKey imageKey() const;
+
+  void updateImage(const ImageKey &key);
+
+  Shape *shapeAt(const QPoint &pos, bool *valid=nullptr);
 
-  void paintEvent(QPaintEvent *) override;
+  void paintEvent(QPaintEvent *e) override;
 
-  void mouseMoveEvent(QMouseEvent *e) override;
+  void mousePressEvent  (QMouseEvent *e) override;
+  void mouseMoveEvent   (QMouseEvent *e) override;
+  void mouseReleaseEvent(QMouseEvent *e) override;
+
+  void wheelEvent(QWheelEvent *e) override;
+
+  void leaveEvent(QEvent *e) override;
 
   bool event(QEvent *e) override;
 
  public slots:
   void print();
 
+ private slots:
+  void updateHover();
+
  private:
   Model*     model_;
-  int        w_, h_;
+  Renderer*  renderer_;
   int        modelNum_;
-  double     scale_;
   int        repeatCount_;
-  bool       dual_;
   QSize      printSize_;
-  QTransform transform_;
-  QTransform itransform_;
+  TileCache* tileCache_;
+  QImage     image_;         // cached rendering of model (from tiles)
+  ImageKey   imageKey_;      // state image was rendered with
+  bool       imageComplete_; // are all tiles of image rendered
+  int        hoverShape_;    // id of shape under mouse (-1 if none)
+  QPoint     hoverPos_;      // last mouse position (hover is updated when ids added)
+  bool       panning_;       // is mouse drag panning view
+  QPoint     panPos_;        // last mouse position of pan
 };
 
 #endif
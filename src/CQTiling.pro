@@ -10,14 +10,20 @@ QMAKE_CXXFLAGS += -std=c++17
 
 CONFIG += debug
 
+# use uniform hash grid instead of quad tree for shape lookup
+#DEFINES += CQTILING_HASH_GRID
+
 # Input
 SOURCES += \
 CQTiling.cpp \
 
 HEADERS += \
 CQTiling.h \
-PointSet.h \
 CQuadTree.h \
+CHashGrid.h \
+CArena.h \
+CVertexIndex.h \
+CHalfEdgeMesh.h \
 
 DESTDIR     = ../bin
 OBJECTS_DIR = ../obj
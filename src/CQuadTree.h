@@ -1,7 +1,13 @@
 #ifndef CQuadTree_H
 #define CQuadTree_H
 
-#include <list>
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <queue>
+#include <limits>
+#include <cstdint>
+#include <cmath>
 #include <cassert>
 
 // quad tree containing pointers to items of type DATA with an associated bbox of type BBOX
@@ -12,6 +18,19 @@
 // tree does not take ownership of data. The application must ensure elements are not
 // deleted while in the tree and are deleted when required.
 //
+// all tree nodes are stored in a single pool and addressed by index. The four sub trees
+// of a node are a block of consecutive nodes and each node keeps its items, with their
+// bboxes when added, in a contiguous array. Blocks removed by reset are reused by later
+// splits, so a tree can be refilled without reallocating its nodes, and queries do not
+// allocate (other than to grow the caller's result list).
+//
+// const queries do not modify the tree so can be run concurrently from any number of
+// threads while no thread modifies the tree. getDataAtPoints and related batch queries
+// can use threads themselves.
+//
+// nearest (kNN) queries search the tree best first, so only nodes closer than the
+// k'th nearest item are visited.
+//
 // DATA must support:
 //   const BBOX &bbox = data->getBBox();
 //
@@ -26,50 +45,62 @@
 template<typename DATA, typename BBOX, typename T=double>
 class CQuadTree {
  public:
-  typedef std::list<DATA *> DataList;
+  typedef std::vector<DATA *> DataList;
 
  private:
-  CQuadTree *parent_;   // parent tree (0 if root)
-  BBOX       bbox_;     // bounding box of tree
-  DataList   dataList_; // data list
-  CQuadTree *bl_tree_;  // bottom left sub tree
-  CQuadTree *br_tree_;  // bottom right sub tree
-  CQuadTree *tl_tree_;  // top left sub tree
-  CQuadTree *tr_tree_;  // top right sub tree
+  // sub tree offsets in child block
+  enum { BL = 0, BR = 1, TL = 2, TR = 3 };
 
- public:
-  explicit CQuadTree(const BBOX &bbox=BBOX(1,1,-1,-1)) :
-   parent_(0), bbox_(bbox), bl_tree_(0), br_tree_(0), tl_tree_(0), tr_tree_(0) {
-  }
+  // item and its bbox when added (used for all filtering so queries do not call
+  // DATA::getBBox)
+  struct Item {
+    DATA *data;
+    BBOX  bbox;
+  };
 
- ~CQuadTree() {
-    delete bl_tree_;
-    delete br_tree_;
-    delete tl_tree_;
-    delete tr_tree_;
-  }
+  typedef std::vector<Item> Items;
 
- private:
-  CQuadTree(CQuadTree *parent, const BBOX &bbox) :
-   parent_(parent), bbox_(bbox), bl_tree_(0), br_tree_(0), tl_tree_(0), tr_tree_(0) {
+  struct Node {
+    BBOX  bbox;            // bounding box of node
+    int   parent   { -1 }; // parent node (-1 if root)
+    int   children { -1 }; // first node of child block (-1 if none)
+    Items items;           // items
+  };
+
+  typedef std::vector<Node> Nodes;
+  typedef std::vector<int>  Blocks;
+
+  Nodes  nodes_;              // node pool (root is first node)
+  Blocks freeBlocks_;         // unused child blocks
+  bool   deferSplit_ { false }; // don't split while adding batch
+
+ public:
+  explicit CQuadTree(const BBOX &bbox=BBOX(1,1,-1,-1)) {
+    nodes_.resize(1);
+
+    nodes_[0].bbox = bbox;
   }
 
  public:
   // reset quad tree
   void reset() {
-    dataList_.clear();
+    nodes_[0].items.clear();
 
-    delete bl_tree_; bl_tree_ = 0;
-    delete br_tree_; br_tree_ = 0;
-    delete tl_tree_; tl_tree_ = 0;
-    delete tr_tree_; tr_tree_ = 0;
+    releaseChildren(0);
   }
 
   // get bounding box
-  const BBOX &getBBox() const { return bbox_; }
+  const BBOX &getBBox() const { return nodes_[0].bbox; }
+
+  // get data items of root
+  DataList getDataList() const {
+    DataList dataList;
 
-  // get data list
-  const DataList &getDataList() const { return dataList_; }
+    for (const auto &item : nodes_[0].items)
+      dataList.push_back(item.data);
+
+    return dataList;
+  }
 
   // get auto split limit
   static uint getAutoSplitLimit() {
@@ -91,17 +122,57 @@ class CQuadTree {
     *getMinTreeSizeP() = limit;
   }
 
-  // get parent tree
-  CQuadTree *getParent() const { return parent_; }
+  // has child trees
+  bool hasChildren() const { return nodes_[0].children >= 0; }
+
+  // get number of nodes in use
+  uint numNodes() const { return uint(nodes_.size() - 4*freeBlocks_.size()); }
 
-  // get sub trees
-  CQuadTree *getBLTree() const { return bl_tree_; }
-  CQuadTree *getBRTree() const { return br_tree_; }
-  CQuadTree *getTLTree() const { return tl_tree_; }
-  CQuadTree *getTRTree() const { return tr_tree_; }
+ private:
+  // get child block for node (reusing free block if available)
+  int allocChildren(int ind) {
+    int c;
 
-  // has child trees
-  bool hasChildren() const { return bl_tree_ != 0; }
+    if (! freeBlocks_.empty()) {
+      c = freeBlocks_.back();
+
+      freeBlocks_.pop_back();
+    }
+    else {
+      c = int(nodes_.size());
+
+      nodes_.resize(nodes_.size() + 4);
+    }
+
+    for (int i = 0; i < 4; ++i) {
+      Node &child = nodes_[c + i];
+
+      child.parent   = ind;
+      child.children = -1;
+
+      child.items.clear();
+    }
+
+    nodes_[ind].children = c;
+
+    return c;
+  }
+
+  // move child block of node (and their child blocks) to free list
+  void releaseChildren(int ind) {
+    int c = nodes_[ind].children;
+    if (c < 0) return;
+
+    for (int i = 0; i < 4; ++i) {
+      nodes_[c + i].items.clear();
+
+      releaseChildren(c + i);
+    }
+
+    freeBlocks_.push_back(c);
+
+    nodes_[ind].children = -1;
+  }
 
   //----------
 
@@ -110,38 +181,271 @@ class CQuadTree {
   void add(DATA *data) {
     const BBOX &bbox = data->getBBox();
 
-    if (! inside(bbox))
+    assert(bbox.getLeft() <= bbox.getRight() && bbox.getBottom() <= bbox.getTop());
+
+    if (! inside(bbox, nodes_[0].bbox))
       grow(bbox);
 
-    addData(data, bbox);
+    addData(0, data, bbox);
   }
 
  private:
-  void addData(DATA *data, const BBOX &bbox) {
-    if (bl_tree_) {
-      if        (bbox.getRight() <= br_tree_->bbox_.getLeft ()) {
-        if        (bbox.getTop   () <= tl_tree_->bbox_.getBottom()) {
-          bl_tree_->addData(data, bbox); return;
-        } else if (bbox.getBottom() >= bl_tree_->bbox_.getTop   ()) {
-          tl_tree_->addData(data, bbox); return;
-        }
-      } else if (bbox.getLeft () >= bl_tree_->bbox_.getRight()) {
-        if        (bbox.getTop   () <= tr_tree_->bbox_.getBottom()) {
-          br_tree_->addData(data, bbox); return;
-        } else if (bbox.getBottom() >= br_tree_->bbox_.getTop   ()) {
-          tr_tree_->addData(data, bbox); return;
-        }
+  void addData(int ind, DATA *data, const BBOX &bbox) {
+    // descend to smallest sub tree containing bbox
+    for (;;) {
+      int c = nodes_[ind].children;
+      if (c < 0) break;
+
+      if      (bbox.getRight() <= nodes_[c + BR].bbox.getLeft ()) {
+        if      (bbox.getTop   () <= nodes_[c + TL].bbox.getBottom()) { ind = c + BL; continue; }
+        else if (bbox.getBottom() >= nodes_[c + BL].bbox.getTop   ()) { ind = c + TL; continue; }
       }
+      else if (bbox.getLeft () >= nodes_[c + BL].bbox.getRight()) {
+        if      (bbox.getTop   () <= nodes_[c + TR].bbox.getBottom()) { ind = c + BR; continue; }
+        else if (bbox.getBottom() >= nodes_[c + BR].bbox.getTop   ()) { ind = c + TR; continue; }
+      }
+
+      break;
     }
 
-    dataList_.push_back(data);
+    Node &node = nodes_[ind];
+
+    node.items.push_back(Item { data, bbox });
 
-    if (! bl_tree_) {
+    if (node.children < 0 && ! deferSplit_) {
       uint limit = getAutoSplitLimit();
 
-      if (limit > 0 && dataList_.size() > limit)
-        autoSplit();
+      if (limit > 0 && node.items.size() > limit)
+        autoSplit(ind, 1);
+    }
+  }
+
+  //----------
+
+ public:
+  // add items [begin, end) to the tree. Splitting is deferred until all items are
+  // added and then overfull sub trees are split until their items fit
+  template<typename ITER>
+  void add(ITER begin, ITER end) {
+    deferSplit_ = true;
+
+    for (ITER p = begin; p != end; ++p)
+      add(*p);
+
+    deferSplit_ = false;
+
+    splitOverfull(0, 1);
+  }
+
+  // replace tree contents with items [begin, end). The root bbox is set to the bbox of
+  // the items and the items partitioned top down, splitting sub trees with more items
+  // than the auto split limit. If parallel the root's sub trees are built in separate
+  // threads
+  template<typename ITER>
+  void build(ITER begin, ITER end, bool parallel=false) {
+    reset();
+
+    Items items;
+
+    for (ITER p = begin; p != end; ++p)
+      items.push_back(Item { *p, (*p)->getBBox() });
+
+    if (items.empty()) return;
+
+    T l = items[0].bbox.getLeft (), b = items[0].bbox.getBottom();
+    T r = items[0].bbox.getRight(), t = items[0].bbox.getTop   ();
+
+    for (const auto &item : items) {
+      l = std::min(l, item.bbox.getLeft  ());
+      b = std::min(b, item.bbox.getBottom());
+      r = std::max(r, item.bbox.getRight ());
+      t = std::max(t, item.bbox.getTop   ());
+    }
+
+    nodes_[0].bbox = BBOX(l, b, r, t);
+
+    if (! parallel)
+      buildNode(0, items, 0, items.size(), 1);
+    else
+      buildParallel(items);
+  }
+
+ private:
+  // max depth of sub trees created by build or batch add
+  static uint maxBuildDepth() { return 32; }
+
+  bool canSplit(std::size_t n, uint depth) const {
+    uint limit = getAutoSplitLimit();
+
+    return (limit > 0 && n > limit && n > getMinTreeSize() && depth < maxBuildDepth());
+  }
+
+  // split leaf sub trees with more items than the auto split limit
+  void splitOverfull(int ind, uint depth) {
+    if (nodes_[ind].children < 0) {
+      T x, y;
+
+      if (! canSplit(nodes_[ind].items.size(), depth) || ! getSplitPoint(ind, x, y))
+        return;
+
+      deferSplit_ = true;
+
+      split(ind, x, y);
+
+      deferSplit_ = false;
+    }
+
+    int c = nodes_[ind].children;
+
+    if (c >= 0) {
+      for (int k = 0; k < 4; ++k)
+        splitOverfull(c + k, depth + 1);
+    }
+  }
+
+  // add items [i1, i2) to node, moving those inside a quarter of the node to sub trees
+  // if there are too many. Items keep their relative order
+  void buildNode(int ind, Items &items, std::size_t i1, std::size_t i2, uint depth) {
+    T x, y;
+
+    if (! canSplit(i2 - i1, depth) || ! getSplitPoint(ind, x, y)) {
+      for (std::size_t i = i1; i < i2; ++i)
+        nodes_[ind].items.push_back(items[i]);
+
+      return;
+    }
+
+    int c = splitNode(ind, x, y);
+
+    // stable partition of items by sub tree (4 for none)
+    std::size_t counts[5] = { 0, 0, 0, 0, 0 };
+
+    std::vector<unsigned char> quads(i2 - i1);
+
+    for (std::size_t i = i1; i < i2; ++i) {
+      int k = 0;
+
+      for ( ; k < 4; ++k)
+        if (inside(items[i].bbox, nodes_[c + k].bbox))
+          break;
+
+      quads[i - i1] = (unsigned char) k;
+
+      ++counts[k];
+    }
+
+    std::size_t starts[5];
+
+    starts[4] = i1;
+
+    for (int k = 0; k < 4; ++k)
+      starts[k] = (k > 0 ? starts[k - 1] + counts[k - 1] : i1 + counts[4]);
+
+    Items items1(i2 - i1);
+
+    std::size_t pos[5] = { starts[0], starts[1], starts[2], starts[3], starts[4] };
+
+    for (std::size_t i = i1; i < i2; ++i)
+      items1[pos[quads[i - i1]]++ - i1] = items[i];
+
+    std::copy(items1.begin(), items1.end(), items.begin() + long(i1));
+
+    for (std::size_t i = starts[4]; i < starts[4] + counts[4]; ++i)
+      nodes_[ind].items.push_back(items[i]);
+
+    for (int k = 0; k < 4; ++k)
+      buildNode(c + k, items, starts[k], starts[k] + counts[k], depth + 1);
+  }
+
+  // build root's sub trees in separate trees (threads) and move them into this tree
+  void buildParallel(Items &items) {
+    T x, y;
+
+    if (! canSplit(items.size(), 1) || ! getSplitPoint(0, x, y)) {
+      buildNode(0, items, 0, items.size(), 1);
+      return;
+    }
+
+    // sub tree nodes are appended so drop the (free) nodes released by reset
+    assert(nodes_[0].children < 0);
+
+    nodes_.resize(1);
+
+    freeBlocks_.clear();
+
+    int c = splitNode(0, x, y);
+
+    Items subItems[4];
+
+    for (const auto &item : items) {
+      int k = 0;
+
+      for ( ; k < 4; ++k)
+        if (inside(item.bbox, nodes_[c + k].bbox))
+          break;
+
+      if (k < 4)
+        subItems[k].push_back(item);
+      else
+        nodes_[0].items.push_back(item);
+    }
+
+    CQuadTree trees[4];
+
+    std::vector<std::thread> threads;
+
+    for (int k = 0; k < 4; ++k) {
+      trees[k].nodes_[0].bbox = nodes_[c + k].bbox;
+
+      threads.emplace_back([&, k]() {
+        trees[k].buildNode(0, subItems[k], 0, subItems[k].size(), 2);
+      });
+    }
+
+    for (auto &thread : threads)
+      thread.join();
+
+    // append nodes of each tree (except root, which replaces sub tree node) remapping
+    // node indices
+    for (int k = 0; k < 4; ++k) {
+      Nodes &nodes1 = trees[k].nodes_;
+
+      int offset = int(nodes_.size()) - 1;
+
+      auto remap = [&](int i) {
+        return (i < 0 ? i : (i == 0 ? c + k : i + offset));
+      };
+
+      for (std::size_t i = 1; i < nodes1.size(); ++i) {
+        Node &node1 = nodes1[i];
+
+        node1.parent   = remap(node1.parent);
+        node1.children = remap(node1.children);
+
+        nodes_.push_back(std::move(node1));
+      }
+
+      Node &node = nodes_[c + k];
+
+      node.children = remap(nodes1[0].children);
+      node.items    = std::move(nodes1[0].items);
     }
+
+    assert(numNodes() == nodes_.size());
+  }
+
+  // create sub trees of leaf node split at x, y
+  int splitNode(int ind, T x, T y) {
+    const BBOX bbox = nodes_[ind].bbox;
+
+    int c = allocChildren(ind);
+
+    nodes_[c + BL].bbox = BBOX(bbox.getLeft(), bbox.getBottom(), x              , y            );
+    nodes_[c + BR].bbox = BBOX(x             , bbox.getBottom(), bbox.getRight(), y            );
+    nodes_[c + TL].bbox = BBOX(bbox.getLeft(), y               , x              , bbox.getTop());
+    nodes_[c + TR].bbox = BBOX(x             , y               , bbox.getRight(), bbox.getTop());
+
+    return c;
   }
 
   //----------
@@ -149,62 +453,103 @@ class CQuadTree {
  public:
   // increase size of bounding box of tree (root)
   void grow(const BBOX &bbox) {
+    grow(0, bbox);
+  }
+
+ private:
+  void grow(int ind, const BBOX &bbox) {
+    const BBOX &bbox1 = nodes_[ind].bbox;
+
     T l, b, r, t;
 
-    if (bbox_.getLeft() > bbox_.getRight()) {
+    if (bbox1.getLeft() > bbox1.getRight()) {
       l = bbox.getLeft  ();
       b = bbox.getBottom();
       r = bbox.getRight ();
       t = bbox.getTop   ();
     }
     else {
-      l = std::min(bbox_.getLeft  (), bbox.getLeft  ());
-      b = std::min(bbox_.getBottom(), bbox.getBottom());
-      r = std::max(bbox_.getRight (), bbox.getRight ());
-      t = std::max(bbox_.getTop   (), bbox.getTop   ());
+      l = std::min(bbox1.getLeft  (), bbox.getLeft  ());
+      b = std::min(bbox1.getBottom(), bbox.getBottom());
+      r = std::max(bbox1.getRight (), bbox.getRight ());
+      t = std::max(bbox1.getTop   (), bbox.getTop   ());
     }
 
-    if (bl_tree_) {
-      const BBOX &bl_bbox = bl_tree_->getBBox();
-      const BBOX &br_bbox = br_tree_->getBBox();
-      const BBOX &tl_bbox = tl_tree_->getBBox();
-      const BBOX &tr_bbox = tr_tree_->getBBox();
-
-      bl_tree_->grow(BBOX(l                 , b                  ,
-                          bl_bbox.getRight(), bl_bbox.getTop   ()));
-      br_tree_->grow(BBOX(br_bbox.getLeft (), b                  ,
-                          r                 , br_bbox.getTop   ()));
-      tl_tree_->grow(BBOX(l                 , tl_bbox.getBottom(),
-                          tl_bbox.getRight(), t                  ));
-      tr_tree_->grow(BBOX(tr_bbox.getLeft (), tr_bbox.getBottom(),
-                          r                 , t                  ));
+    int c = nodes_[ind].children;
+
+    if (c >= 0) {
+      const BBOX bl_bbox = nodes_[c + BL].bbox;
+      const BBOX br_bbox = nodes_[c + BR].bbox;
+      const BBOX tl_bbox = nodes_[c + TL].bbox;
+      const BBOX tr_bbox = nodes_[c + TR].bbox;
+
+      grow(c + BL, BBOX(l                 , b                  ,
+                        bl_bbox.getRight(), bl_bbox.getTop   ()));
+      grow(c + BR, BBOX(br_bbox.getLeft (), b                  ,
+                        r                 , br_bbox.getTop   ()));
+      grow(c + TL, BBOX(l                 , tl_bbox.getBottom(),
+                        tl_bbox.getRight(), t                  ));
+      grow(c + TR, BBOX(tr_bbox.getLeft (), tr_bbox.getBottom(),
+                        r                 , t                  ));
     }
 
-    bbox_ = BBOX(l, b, r, t);
+    nodes_[ind].bbox = BBOX(l, b, r, t);
   }
 
   //----------
 
  public:
-  // remove data from tree
+  // remove data from tree. Items are matched by data so the data's bbox may have
+  // changed since it was added (its current bbox is only used to find it quickly)
   void remove(DATA *data) {
     const BBOX &bbox = data->getBBox();
 
-    assert(inside(bbox));
+    int ind = 0;
+
+    for (;;) {
+      if (removeData(ind, data))
+        return;
+
+      int c = nodes_[ind].children;
+      if (c < 0) break;
+
+      int i = 0;
 
-    removeData(data, bbox);
+      for ( ; i < 4; ++i)
+        if (inside(bbox, nodes_[c + i].bbox))
+          break;
+
+      if (i == 4) break;
+
+      ind = c + i;
+    }
+
+    // not on path of current bbox so search all nodes
+    for (std::size_t i = 0; i < nodes_.size(); ++i)
+      if (removeData(int(i), data))
+        return;
+  }
+
+  // move data to position of its current bbox
+  void update(DATA *data) {
+    remove(data);
+
+    add(data);
   }
 
  private:
-  void removeData(DATA *data, const BBOX &bbox) {
-    if (bl_tree_) {
-      if      (bl_tree_->inside(bbox)) return bl_tree_->removeData(data, bbox);
-      else if (br_tree_->inside(bbox)) return br_tree_->removeData(data, bbox);
-      else if (tl_tree_->inside(bbox)) return tl_tree_->removeData(data, bbox);
-      else if (tr_tree_->inside(bbox)) return tr_tree_->removeData(data, bbox);
-    }
+  bool removeData(int ind, DATA *data) {
+    Items &items = nodes_[ind].items;
+
+    auto p = std::find_if(items.begin(), items.end(),
+                          [&](const Item &item) { return item.data == data; });
+
+    if (p == items.end())
+      return false;
+
+    items.erase(p);
 
-    dataList_.remove(data);
+    return true;
   }
 
   //----------
@@ -212,44 +557,48 @@ class CQuadTree {
  public:
   // split tree at point (defining vertical and horizontal split)
   void split(T x, T y) {
-    if (bbox_.getLeft() == bbox_.getRight() && bbox_.getBottom() == bbox_.getRight()) return;
+    split(0, x, y);
+  }
+
+ private:
+  void split(int ind, T x, T y) {
+    const BBOX bbox = nodes_[ind].bbox;
+
+    if (bbox.getLeft() == bbox.getRight() && bbox.getBottom() == bbox.getTop()) return;
 
-    if (! bl_tree_) {
-      if (x <= bbox_.getLeft()   || x >= bbox_.getRight() ||
-          y <= bbox_.getBottom() || y >= bbox_.getTop()) return;
+    int c = nodes_[ind].children;
 
-      BBOX blbbox(bbox_.getLeft(), bbox_.getBottom(), x               , y             );
-      BBOX brbbox(x              , bbox_.getBottom(), bbox_.getRight(), y             );
-      BBOX tlbbox(bbox_.getLeft(), y                , x               , bbox_.getTop());
-      BBOX trbbox(x              , y                , bbox_.getRight(), bbox_.getTop());
+    if (c < 0) {
+      if (x <= bbox.getLeft()   || x >= bbox.getRight() ||
+          y <= bbox.getBottom() || y >= bbox.getTop()) return;
 
-      bl_tree_ = new CQuadTree(this, blbbox);
-      br_tree_ = new CQuadTree(this, brbbox);
-      tl_tree_ = new CQuadTree(this, tlbbox);
-      tr_tree_ = new CQuadTree(this, trbbox);
+      c = splitNode(ind, x, y);
 
-      typename DataList::iterator p1 = dataList_.begin();
-      typename DataList::iterator p2 = dataList_.end  ();
+      // move items to sub trees which contain them (keeping order of the rest).
+      // Adding to a sub tree can split it and grow the node pool so nodes are
+      // always accessed by index
+      std::size_t n = nodes_[ind].items.size(), j = 0;
 
-      while (p1 != p2) {
-        const BBOX &bbox = (*p1)->getBBox();
+      for (std::size_t i = 0; i < n; ++i) {
+        Item item = nodes_[ind].items[i];
 
-        if      (bl_tree_->inside(bbox)) bl_tree_->add(*p1);
-        else if (br_tree_->inside(bbox)) br_tree_->add(*p1);
-        else if (tl_tree_->inside(bbox)) tl_tree_->add(*p1);
-        else if (tr_tree_->inside(bbox)) tr_tree_->add(*p1);
-        else                             { ++p1; continue; }
+        int k = 0;
 
-        typename DataList::iterator p = p1++;
+        for ( ; k < 4; ++k)
+          if (inside(item.bbox, nodes_[c + k].bbox))
+            break;
 
-        dataList_.erase(p);
+        if (k < 4)
+          addData(c + k, item.data, item.bbox);
+        else
+          nodes_[ind].items[j++] = item;
       }
+
+      nodes_[ind].items.resize(j);
     }
     else {
-      bl_tree_->split(x, y);
-      br_tree_->split(x, y);
-      tl_tree_->split(x, y);
-      tr_tree_->split(x, y);
+      for (int k = 0; k < 4; ++k)
+        split(c + k, x, y);
     }
   }
 
@@ -257,44 +606,54 @@ class CQuadTree {
   // automatically split tree (1 or more times)
   // the split point is automatically determined from the data
   bool autoSplit(uint n=1) {
+    return autoSplit(0, n);
+  }
+
+ private:
+  bool autoSplit(int ind, uint n) {
     if (n == 0) return false;
 
-    if (! bl_tree_) {
-      if (dataList_.size() <= getMinTreeSize()) return false;
+    int c = nodes_[ind].children;
+
+    if (c < 0) {
+      if (nodes_[ind].items.size() <= getMinTreeSize()) return false;
 
       T x, y;
 
-      if (getSplitPoint(x, y)) {
-        split(x, y);
+      if (getSplitPoint(ind, x, y)) {
+        split(ind, x, y);
 
-        if (bl_tree_) {
-          bl_tree_->autoSplit(n - 1);
-          br_tree_->autoSplit(n - 1);
-          tl_tree_->autoSplit(n - 1);
-          tr_tree_->autoSplit(n - 1);
+        c = nodes_[ind].children;
+
+        if (c >= 0) {
+          for (int k = 0; k < 4; ++k)
+            autoSplit(c + k, n - 1);
         }
       }
     }
     else {
-      bl_tree_->autoSplit(n);
-      br_tree_->autoSplit(n);
-      tl_tree_->autoSplit(n);
-      tr_tree_->autoSplit(n);
+      for (int k = 0; k < 4; ++k)
+        autoSplit(c + k, n);
     }
 
     return true;
   }
 
- private:
-  bool getSplitPoint(T &x, T &y) {
-    x = (bbox_.getRight() + bbox_.getLeft  ())/2;
-    y = (bbox_.getTop  () + bbox_.getBottom())/2;
+  bool getSplitPoint(int ind, T &x, T &y) const {
+    const BBOX &bbox = nodes_[ind].bbox;
+
+    x = (bbox.getRight() + bbox.getLeft  ())/2;
+    y = (bbox.getTop  () + bbox.getBottom())/2;
 
-    return (x != bbox_.getLeft() && y != bbox_.getBottom());
+    return (x != bbox.getLeft() && y != bbox.getBottom());
   }
 
   //-------
 
+  // visitor queries pass each matching item to visitor (bool visitor(DATA *)) in the
+  // same order as the list queries and stop as soon as the visitor returns true.
+  // They return true if stopped by the visitor
+
  public:
   // get data items inside the specified bounding box
   void getDataInsideBBox(const BBOX &bbox, DataList &dataList) const {
@@ -304,29 +663,38 @@ class CQuadTree {
   }
 
   void addDataInsideBBox(const BBOX &bbox, DataList &dataList) const {
-    if (! overlaps(bbox))
-      return;
+    visitDataInsideBBox(bbox, [&](DATA *data) { dataList.push_back(data); return false; });
+  }
 
-    // if tree completely inside, add all items
-    if (inside(bbox_, bbox))
-      addTreeDataToList(dataList);
-    else {
-      typename DataList::const_iterator p1, p2;
+  template<typename VISITOR>
+  bool visitDataInsideBBox(const BBOX &bbox, VISITOR &&visitor) const {
+    return visitDataInsideBBox(0, bbox, visitor);
+  }
 
-      for (p1 = dataList_.begin(), p2 = dataList_.end(); p1 != p2; ++p1) {
-        const BBOX &bbox1 = (*p1)->getBBox();
+ private:
+  template<typename VISITOR>
+  bool visitDataInsideBBox(int ind, const BBOX &bbox, VISITOR &visitor) const {
+    const Node &node = nodes_[ind];
 
-        if (inside(bbox1, bbox))
-          dataList.push_back(*p1);
-      }
+    if (! overlaps(node.bbox, bbox))
+      return false;
 
-      if (bl_tree_) {
-        bl_tree_->addDataInsideBBox(bbox, dataList);
-        br_tree_->addDataInsideBBox(bbox, dataList);
-        tl_tree_->addDataInsideBBox(bbox, dataList);
-        tr_tree_->addDataInsideBBox(bbox, dataList);
-      }
+    // if tree completely inside, add all items
+    if (inside(node.bbox, bbox))
+      return visitTreeData(ind, visitor);
+
+    for (const auto &item : node.items) {
+      if (inside(item.bbox, bbox) && visitor(item.data))
+        return true;
+    }
+
+    if (node.children >= 0) {
+      for (int k = 0; k < 4; ++k)
+        if (visitDataInsideBBox(node.children + k, bbox, visitor))
+          return true;
     }
+
+    return false;
   }
 
   //-------
@@ -336,40 +704,54 @@ class CQuadTree {
   void getDataTouchingBBox(const BBOX &bbox, DataList &dataList) const {
     dataList.clear();
 
-    if (overlaps(bbox))
-      addDataTouchingBBox(bbox, dataList);
+    addDataTouchingBBox(bbox, dataList);
   }
 
   void addDataTouchingBBox(const BBOX &bbox, DataList &dataList) const {
+    visitDataTouchingBBox(bbox, [&](DATA *data) { dataList.push_back(data); return false; });
+  }
+
+  template<typename VISITOR>
+  bool visitDataTouchingBBox(const BBOX &bbox, VISITOR &&visitor) const {
+    if (! overlaps(bbox, nodes_[0].bbox))
+      return false;
+
+    return visitDataTouchingBBox(0, bbox, visitor);
+  }
+
+ private:
+  template<typename VISITOR>
+  bool visitDataTouchingBBox(int ind, const BBOX &bbox, VISITOR &visitor) const {
+    const Node &node = nodes_[ind];
+
     // if tree completely inside, add all items
-    if (inside(bbox_, bbox))
-      addTreeDataToList(dataList);
-    else {
-      typename DataList::const_iterator p1, p2;
+    if (inside(node.bbox, bbox))
+      return visitTreeData(ind, visitor);
 
-      for (p1 = dataList_.begin(), p2 = dataList_.end(); p1 != p2; ++p1) {
-        const BBOX &bbox1 = (*p1)->getBBox();
+    for (const auto &item : node.items) {
+      if (overlaps(item.bbox, bbox) && visitor(item.data))
+        return true;
+    }
 
-        if (overlaps(bbox1, bbox))
-          dataList.push_back(*p1);
-      }
+    int c = node.children;
 
-      if (bl_tree_) {
-        if (bbox.getLeft() <= br_tree_->bbox_.getLeft()) {
-          if (bbox.getBottom() <= tl_tree_->bbox_.getBottom())
-            bl_tree_->addDataTouchingBBox(bbox, dataList);
-          if (bbox.getTop   () >= bl_tree_->bbox_.getTop())
-            tl_tree_->addDataTouchingBBox(bbox, dataList);
-        }
+    if (c >= 0) {
+      if (bbox.getLeft() <= nodes_[c + BR].bbox.getLeft()) {
+        if (bbox.getBottom() <= nodes_[c + TL].bbox.getBottom())
+          if (visitDataTouchingBBox(c + BL, bbox, visitor)) return true;
+        if (bbox.getTop   () >= nodes_[c + BL].bbox.getTop())
+          if (visitDataTouchingBBox(c + TL, bbox, visitor)) return true;
+      }
 
-        if (bbox.getRight() >= bl_tree_->bbox_.getRight()) {
-          if (bbox.getBottom() <= tr_tree_->bbox_.getBottom())
-            br_tree_->addDataTouchingBBox(bbox, dataList);
-          if (bbox.getTop   () >= br_tree_->bbox_.getTop())
-            tr_tree_->addDataTouchingBBox(bbox, dataList);
-        }
+      if (bbox.getRight() >= nodes_[c + BL].bbox.getRight()) {
+        if (bbox.getBottom() <= nodes_[c + TR].bbox.getBottom())
+          if (visitDataTouchingBBox(c + BR, bbox, visitor)) return true;
+        if (bbox.getTop   () >= nodes_[c + BR].bbox.getTop())
+          if (visitDataTouchingBBox(c + TR, bbox, visitor)) return true;
       }
     }
+
+    return false;
   }
 
   //-------
@@ -383,102 +765,404 @@ class CQuadTree {
   }
 
   void addDataAtPoint(T x, T y, DataList &dataList) const {
-    if (x < bbox_.getLeft  () || x > bbox_.getRight() ||
-        y < bbox_.getBottom() || y > bbox_.getTop  ())
-      return;
+    visitDataAtPoint(x, y, [&](DATA *data) { dataList.push_back(data); return false; });
+  }
+
+  template<typename VISITOR>
+  bool visitDataAtPoint(T x, T y, VISITOR &&visitor) const {
+    return visitDataAtPoint(0, x, y, visitor);
+  }
+
+  // get first data item which has the specified point inside it and matches
+  // predicate (bool pred(DATA *))
+  template<typename PRED>
+  DATA *findFirstAtPoint(T x, T y, PRED &&pred) const {
+    DATA *found = nullptr;
+
+    visitDataAtPoint(x, y, [&](DATA *data) {
+      if (! pred(data)) return false;
+
+      found = data;
+
+      return true;
+    });
+
+    return found;
+  }
+
+ private:
+  template<typename VISITOR>
+  bool visitDataAtPoint(int ind, T x, T y, VISITOR &visitor) const {
+    const Node &node = nodes_[ind];
 
-    typename DataList::const_iterator p1, p2;
+    if (x < node.bbox.getLeft  () || x > node.bbox.getRight() ||
+        y < node.bbox.getBottom() || y > node.bbox.getTop  ())
+      return false;
 
-    for (p1 = dataList_.begin(), p2 = dataList_.end(); p1 != p2; ++p1) {
-      const BBOX &bbox = (*p1)->getBBox();
+    for (const auto &item : node.items) {
+      const BBOX &bbox = item.bbox;
 
       if (x >= bbox.getLeft  () && x <= bbox.getRight() &&
-          y >= bbox.getBottom() && y <= bbox.getTop  ())
-        dataList.push_back(*p1);
+          y >= bbox.getBottom() && y <= bbox.getTop  () && visitor(item.data))
+        return true;
     }
 
-    if (bl_tree_) {
-      if (x <= br_tree_->bbox_.getLeft()) {
-        if (y <= tl_tree_->bbox_.getBottom())
-          bl_tree_->addDataAtPoint(x, y, dataList);
-        if (y >= bl_tree_->bbox_.getTop())
-          tl_tree_->addDataAtPoint(x, y, dataList);
+    int c = node.children;
+
+    if (c >= 0) {
+      if (x <= nodes_[c + BR].bbox.getLeft()) {
+        if (y <= nodes_[c + TL].bbox.getBottom())
+          if (visitDataAtPoint(c + BL, x, y, visitor)) return true;
+        if (y >= nodes_[c + BL].bbox.getTop())
+          if (visitDataAtPoint(c + TL, x, y, visitor)) return true;
       }
 
-      if (x >= bl_tree_->bbox_.getRight()) {
-        if (y <= tr_tree_->bbox_.getBottom())
-          br_tree_->addDataAtPoint(x, y, dataList);
-        if (y >= br_tree_->bbox_.getTop())
-          tr_tree_->addDataAtPoint(x, y, dataList);
+      if (x >= nodes_[c + BL].bbox.getRight()) {
+        if (y <= nodes_[c + TR].bbox.getBottom())
+          if (visitDataAtPoint(c + BR, x, y, visitor)) return true;
+        if (y >= nodes_[c + BR].bbox.getTop())
+          if (visitDataAtPoint(c + TR, x, y, visitor)) return true;
       }
     }
+
+    return false;
   }
 
   //-------
 
  public:
-  // get tree which has the specified point inside it
-  const CQuadTree *getTreeAtPoint(T x, T y) const {
-    if (x < bbox_.getLeft  () || x > bbox_.getRight() ||
-        y < bbox_.getBottom() || y > bbox_.getTop  ())
-      return 0;
+  // get data items at each point (results[i] for points[i]). Points are sorted
+  // spatially (Morton order) and answered together in one traversal of the tree,
+  // optionally split across threads.
+  //
+  // POINT must support:
+  //   T x = point.x(); T y = point.y();
+  template<typename POINT>
+  void getDataAtPoints(const std::vector<POINT> &points, std::vector<DataList> &results,
+                       bool parallel=false) const {
+    results.clear();
+    results.resize(points.size());
+
+    visitDataAtPoints(points, [&](std::size_t i, DATA *data) {
+      results[i].push_back(data); return false;
+    }, parallel);
+  }
 
-    typename DataList::const_iterator p1, p2;
+  // get first data item at each point which matches predicate (bool pred(i, DATA *))
+  // (found[i] is null if none)
+  template<typename POINT, typename PRED>
+  void findFirstAtPoints(const std::vector<POINT> &points, std::vector<DATA *> &found,
+                         PRED &&pred, bool parallel=false) const {
+    found.assign(points.size(), nullptr);
 
-    for (p1 = dataList_.begin(), p2 = dataList_.end(); p1 != p2; ++p1) {
-      const BBOX &bbox = (*p1)->getBBox();
+    visitDataAtPoints(points, [&](std::size_t i, DATA *data) {
+      if (! pred(i, data)) return false;
 
-      if (x >= bbox.getLeft  () && x <= bbox.getRight() &&
-          y >= bbox.getBottom() && y <= bbox.getTop  ())
-        return this;
+      found[i] = data;
+
+      return true;
+    }, parallel);
+  }
+
+  // pass data items at each point to visitor (bool visitor(i, DATA *)) in the same
+  // order as visitDataAtPoint. Visiting of a point stops when the visitor returns true.
+  // If parallel the visitor is called from several threads but only ever from one
+  // thread for a given point
+  template<typename POINT, typename VISITOR>
+  void visitDataAtPoints(const std::vector<POINT> &points, VISITOR &&visitor,
+                         bool parallel=false) const {
+    std::size_t n = points.size();
+
+    // small batches are not worth sorting
+    if (n < minBatchSize()) {
+      for (std::size_t i = 0; i < n; ++i)
+        visitDataAtPoint(points[i].x(), points[i].y(), [&](DATA *data) {
+          return visitor(i, data);
+        });
+
+      return;
     }
 
-    if (bl_tree_) {
-      const CQuadTree *tree = 0;
+    Indices inds = mortonOrder(points);
 
-      if ((tree = bl_tree_->getTreeAtPoint(x, y)) != 0) return tree;
-      if ((tree = br_tree_->getTreeAtPoint(x, y)) != 0) return tree;
-      if ((tree = tl_tree_->getTreeAtPoint(x, y)) != 0) return tree;
-      if ((tree = tr_tree_->getTreeAtPoint(x, y)) != 0) return tree;
+    std::vector<unsigned char> done(n, 0);
+
+    auto visitRange = [&](std::size_t i1, std::size_t i2) {
+      Indices inds1(inds.begin() + long(i1), inds.begin() + long(i2));
+
+      visitDataAtPoints(0, points, inds1, done, visitor);
+    };
+
+    std::size_t nt = (parallel ? std::max(std::thread::hardware_concurrency(), 1U) : 1);
+
+    nt = std::min(nt, n/minBatchSize());
+
+    if (nt <= 1) {
+      visitRange(0, n);
+      return;
     }
 
-    return this;
-  }
+    // split points into runs of consecutive (so nearby) points for each thread
+    std::vector<std::thread> threads;
 
-  //-------
+    for (std::size_t t = 0; t < nt; ++t)
+      threads.emplace_back(visitRange, t*n/nt, (t + 1)*n/nt);
+
+    for (auto &thread : threads)
+      thread.join();
+  }
 
  private:
-  void addTreeDataToList(DataList &dataList) const {
-    typename DataList::const_iterator p1, p2;
+  typedef std::vector<std::size_t> Indices;
+
+  static std::size_t minBatchSize() { return 32; }
+
+  // get point indices sorted by Morton code of point in root bbox
+  template<typename POINT>
+  Indices mortonOrder(const std::vector<POINT> &points) const {
+    const BBOX &bbox = nodes_[0].bbox;
+
+    T w = bbox.getRight() - bbox.getLeft  ();
+    T h = bbox.getTop  () - bbox.getBottom();
+
+    auto toInt = [](T f) {
+      return uint32_t(std::min(std::max(f, T(0)), T(1))*65535);
+    };
+
+    // interleave lower 16 bits of x and y
+    auto spread = [](uint32_t v) {
+      v = (v | (v << 8)) & 0x00FF00FF;
+      v = (v | (v << 4)) & 0x0F0F0F0F;
+      v = (v | (v << 2)) & 0x33333333;
+      v = (v | (v << 1)) & 0x55555555;
+
+      return v;
+    };
+
+    std::vector<uint32_t> codes(points.size());
+
+    for (std::size_t i = 0; i < points.size(); ++i) {
+      uint32_t x = toInt(w > 0 ? (points[i].x() - bbox.getLeft  ())/w : T(0));
+      uint32_t y = toInt(h > 0 ? (points[i].y() - bbox.getBottom())/h : T(0));
+
+      codes[i] = spread(x) | (spread(y) << 1);
+    }
+
+    Indices inds(points.size());
+
+    for (std::size_t i = 0; i < inds.size(); ++i)
+      inds[i] = i;
+
+    std::stable_sort(inds.begin(), inds.end(), [&](std::size_t i1, std::size_t i2) {
+      return codes[i1] < codes[i2];
+    });
+
+    return inds;
+  }
+
+  template<typename POINT, typename VISITOR>
+  void visitDataAtPoints(int ind, const std::vector<POINT> &points, const Indices &inds,
+                         std::vector<unsigned char> &done, VISITOR &visitor) const {
+    const Node &node = nodes_[ind];
+
+    // points (not done) inside node
+    Indices inds1;
+
+    for (auto i : inds) {
+      T x = points[i].x(), y = points[i].y();
+
+      if (! done[i] &&
+          x >= node.bbox.getLeft  () && x <= node.bbox.getRight() &&
+          y >= node.bbox.getBottom() && y <= node.bbox.getTop  ())
+        inds1.push_back(i);
+    }
+
+    if (inds1.empty()) return;
 
-    for (p1 = dataList_.begin(), p2 = dataList_.end(); p1 != p2; ++p1)
-      dataList.push_back(*p1);
+    for (const auto &item : node.items) {
+      const BBOX &bbox = item.bbox;
 
-    if (bl_tree_) {
-      bl_tree_->addTreeDataToList(dataList);
-      br_tree_->addTreeDataToList(dataList);
-      tl_tree_->addTreeDataToList(dataList);
-      tr_tree_->addTreeDataToList(dataList);
+      for (auto i : inds1) {
+        if (done[i]) continue;
+
+        T x = points[i].x(), y = points[i].y();
+
+        if (x >= bbox.getLeft  () && x <= bbox.getRight() &&
+            y >= bbox.getBottom() && y <= bbox.getTop  () && visitor(i, item.data))
+          done[i] = 1;
+      }
+    }
+
+    int c = node.children;
+    if (c < 0) return;
+
+    // same sub tree selection as visitDataAtPoint (point on split goes to both)
+    Indices childInds[4];
+
+    for (auto i : inds1) {
+      if (done[i]) continue;
+
+      T x = points[i].x(), y = points[i].y();
+
+      if (x <= nodes_[c + BR].bbox.getLeft()) {
+        if (y <= nodes_[c + TL].bbox.getBottom()) childInds[BL].push_back(i);
+        if (y >= nodes_[c + BL].bbox.getTop   ()) childInds[TL].push_back(i);
+      }
+
+      if (x >= nodes_[c + BL].bbox.getRight()) {
+        if (y <= nodes_[c + TR].bbox.getBottom()) childInds[BR].push_back(i);
+        if (y >= nodes_[c + BR].bbox.getTop   ()) childInds[TR].push_back(i);
+      }
+    }
+
+    static const int order[4] = { BL, TL, BR, TR };
+
+    for (auto k : order) {
+      if (! childInds[k].empty())
+        visitDataAtPoints(c + k, points, childInds[k], done, visitor);
     }
   }
 
   //-------
 
- private:
-  // is bbox inside tree
-  bool inside(const BBOX &bbox) const {
-    assert(bbox.getLeft() <= bbox.getRight() && bbox.getBottom() <= bbox.getTop());
+  // nearest queries visit items in order of increasing distance from a point (best
+  // first search of the tree). Distance is the distance to the item's bbox (zero if
+  // inside) unless a distance functor (T dist(DATA *)) is supplied, e.g. the exact
+  // distance to a polygon (functor distances less than the bbox distance are raised
+  // to it). Items further than maxDist are ignored and items at equal distance are
+  // visited in tree order
 
-    return inside(bbox, bbox_);
+ public:
+  // get up to k data items nearest to point (nearest first)
+  void getNearest(T x, T y, uint k, DataList &dataList, T maxDist=maxDistance()) const {
+    getNearest(x, y, k, [](DATA *) { return T(0); }, dataList, maxDist);
   }
 
-  // does bbox overlap tree
-  bool overlaps(const BBOX &bbox) const {
-    assert(bbox.getLeft() <= bbox.getRight() && bbox.getBottom() <= bbox.getTop());
+  template<typename DIST>
+  void getNearest(T x, T y, uint k, DIST &&dist, DataList &dataList,
+                  T maxDist=maxDistance()) const {
+    dataList.clear();
+
+    if (k == 0) return;
+
+    visitNearest(x, y, dist, [&](DATA *data, T) {
+      dataList.push_back(data);
+
+      return (dataList.size() >= k);
+    }, maxDist);
+  }
+
+  // get nearest data item to point which matches predicate (bool pred(DATA *))
+  template<typename DIST, typename PRED>
+  DATA *findNearest(T x, T y, DIST &&dist, PRED &&pred, T maxDist=maxDistance()) const {
+    DATA *found = nullptr;
+
+    visitNearest(x, y, dist, [&](DATA *data, T) {
+      if (! pred(data)) return false;
+
+      found = data;
+
+      return true;
+    }, maxDist);
+
+    return found;
+  }
+
+  // pass data items to visitor (bool visitor(DATA *, T dist)) nearest first, stopping
+  // as soon as the visitor returns true. Returns true if stopped by the visitor
+  template<typename DIST, typename VISITOR>
+  bool visitNearest(T x, T y, DIST &&dist, VISITOR &&visitor,
+                    T maxDist=maxDistance()) const {
+    // queue of nodes and items ordered by distance (lower bound for nodes and for items
+    // whose exact distance is not yet known) and then by push order
+    struct Entry {
+      T           d;
+      std::size_t seq;
+      int         ind;
+      DATA       *data;
+      bool        exact;
+
+      bool operator<(const Entry &rhs) const {
+        return (d != rhs.d ? d > rhs.d : seq > rhs.seq);
+      }
+    };
+
+    std::priority_queue<Entry> queue;
+
+    std::size_t seq = 0;
+
+    auto push = [&](T d, int ind, DATA *data, bool exact) {
+      if (d <= maxDist)
+        queue.push(Entry { d, seq++, ind, data, exact });
+    };
+
+    if (nodes_[0].bbox.getLeft() <= nodes_[0].bbox.getRight())
+      push(bboxDistance(nodes_[0].bbox, x, y), 0, nullptr, false);
+
+    while (! queue.empty()) {
+      Entry e = queue.top(); queue.pop();
+
+      if      (e.data) {
+        // exact distance only needs requeuing if it is further than the bbox distance
+        T d = (e.exact ? e.d : std::max(T(dist(e.data)), e.d));
+
+        if (d <= e.d) {
+          if (visitor(e.data, d))
+            return true;
+        }
+        else
+          push(d, -1, e.data, true);
+      }
+      else {
+        const Node &node = nodes_[e.ind];
+
+        for (const auto &item : node.items)
+          push(bboxDistance(item.bbox, x, y), -1, item.data, false);
 
-    return overlaps(bbox, bbox_);
+        if (node.children >= 0) {
+          for (int k = 0; k < 4; ++k)
+            push(bboxDistance(nodes_[node.children + k].bbox, x, y),
+                 node.children + k, nullptr, false);
+        }
+      }
+    }
+
+    return false;
   }
 
+  // get distance from point to bbox (zero if inside)
+  static T bboxDistance(const BBOX &bbox, T x, T y) {
+    T dx = std::max(std::max(bbox.getLeft  () - x, x - bbox.getRight()), T(0));
+    T dy = std::max(std::max(bbox.getBottom() - y, y - bbox.getTop  ()), T(0));
+
+    return std::hypot(dx, dy);
+  }
+
+  static T maxDistance() { return std::numeric_limits<T>::max(); }
+
+  //-------
+
+ private:
+  template<typename VISITOR>
+  bool visitTreeData(int ind, VISITOR &visitor) const {
+    const Node &node = nodes_[ind];
+
+    for (const auto &item : node.items)
+      if (visitor(item.data))
+        return true;
+
+    if (node.children >= 0) {
+      for (int k = 0; k < 4; ++k)
+        if (visitTreeData(node.children + k, visitor))
+          return true;
+    }
+
+    return false;
+  }
+
+  //-------
+
+ private:
   // is bbox1 inside bbox2
   static bool inside(const BBOX &bbox1, const BBOX &bbox2) {
     return ((bbox1.getLeft  () >= bbox2.getLeft  () && bbox1.getRight() <= bbox2.getRight()) &&
@@ -494,52 +1178,86 @@ class CQuadTree {
   //-------
 
  public:
-  uint numElements() const {
-    uint n = dataList_.size();
+  uint numElements() const { return numElements(0); }
+
+  uint minElements() const { return minElements(0); }
+
+  uint maxElements() const { return maxElements(0); }
+
+  // get maximum depth of tree (root is depth 1)
+  uint getDepth() const { return getDepth(0); }
 
-    if (bl_tree_)
-      n = bl_tree_->numElements() + br_tree_->numElements() +
-          tl_tree_->numElements() + tr_tree_->numElements();
+  uint maxBorder() const { return maxBorder(0); }
+
+ private:
+  uint numElements(int ind) const {
+    const Node &node = nodes_[ind];
+
+    uint n = uint(node.items.size());
+
+    if (node.children >= 0) {
+      for (int k = 0; k < 4; ++k)
+        n += numElements(node.children + k);
+    }
 
     return n;
   }
 
-  uint minElements() const {
-    uint n = dataList_.size();
+  uint minElements(int ind) const {
+    const Node &node = nodes_[ind];
+
+    uint n = uint(node.items.size());
 
-    if (bl_tree_)
-      n = std::min(std::min(bl_tree_->minElements(), br_tree_->minElements()),
-                   std::min(tl_tree_->minElements(), tr_tree_->minElements()));
+    if (node.children >= 0) {
+      n = minElements(node.children);
+
+      for (int k = 1; k < 4; ++k)
+        n = std::min(n, minElements(node.children + k));
+    }
 
     return n;
   }
 
-  uint maxElements() const {
-    uint n = dataList_.size();
+  uint maxElements(int ind) const {
+    const Node &node = nodes_[ind];
+
+    uint n = uint(node.items.size());
 
-    if (bl_tree_)
-      n = std::max(std::max(bl_tree_->maxElements(), br_tree_->maxElements()),
-                   std::max(tl_tree_->maxElements(), tr_tree_->maxElements()));
+    if (node.children >= 0) {
+      n = maxElements(node.children);
+
+      for (int k = 1; k < 4; ++k)
+        n = std::max(n, maxElements(node.children + k));
+    }
 
     return n;
   }
 
-  uint getDepth() const {
-    return (parent_ ? parent_->getDepth() + 1 : 1);
-  }
+  uint getDepth(int ind) const {
+    const Node &node = nodes_[ind];
 
-  uint maxBorder() const {
-    if (bl_tree_) {
-      uint nd = dataList_.size();
-      uint nl = bl_tree_->maxBorder();
-      uint nr = br_tree_->maxBorder();
-      uint nb = tl_tree_->maxBorder();
-      uint nt = tr_tree_->maxBorder();
+    uint d = 0;
 
-      return std::max(nd, std::max(nl, std::max(nr, std::max(nb, nt))));
+    if (node.children >= 0) {
+      for (int k = 0; k < 4; ++k)
+        d = std::max(d, getDepth(node.children + k));
     }
-    else
+
+    return d + 1;
+  }
+
+  uint maxBorder(int ind) const {
+    const Node &node = nodes_[ind];
+
+    if (node.children < 0)
       return 0;
+
+    uint n = uint(node.items.size());
+
+    for (int k = 0; k < 4; ++k)
+      n = std::max(n, maxBorder(node.children + k));
+
+    return n;
   }
 
  private:
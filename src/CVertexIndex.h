@@ -0,0 +1,215 @@
+#ifndef CVertexIndex_H
+#define CVertexIndex_H
+
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <cstdint>
+#include <cmath>
+#include <cassert>
+
+// index of points (vertices) with the data items (e.g. shapes) which share them
+//
+// points whose x and y each differ by less than tol are merged (as the fuzzy point
+// compare of the old PointData). Points are snapped to a grid of 4*tol and the integer
+// cell coordinates used as the key of an open addressing hash table, so a matching
+// vertex is in the point's cell or, for a point within tol of a cell edge, the adjacent
+// cell, and lookup is constant time. Cells can hold more than one vertex so each
+// candidate is checked against tol.
+//
+// vertices are stored (and iterated) in the order they were first added and keep up
+// to N data items inline (the rest are stored in a separate heap block). clear keeps
+// allocated storage for the next fill.
+//
+// POINT must support:
+//   double x = point.x(); double y = point.y();
+//
+// DATA must be default constructible and support ==
+//
+template<typename POINT, typename DATA, uint N=6>
+class CVertexIndex {
+ public:
+  // vertex point and its (unique) data items
+  class Vertex {
+   public:
+    Vertex(const POINT &point, int64_t kx, int64_t ky) :
+     point_(point), kx_(kx), ky_(ky) {
+    }
+
+    const POINT &point() const { return point_; }
+
+    uint size() const { return n_; }
+
+    const DATA *begin() const { return (heap_ ? heap_.get() : data_); }
+    const DATA *end  () const { return begin() + n_; }
+
+    const DATA &operator[](uint i) const { assert(i < n_); return begin()[i]; }
+
+   private:
+    friend class CVertexIndex;
+
+    void add(const DATA &data) {
+      if (std::find(begin(), end(), data) != end())
+        return;
+
+      if (n_ == cap_) {
+        std::unique_ptr<DATA[]> heap(new DATA[2*cap_]);
+
+        std::copy(begin(), end(), heap.get());
+
+        heap_ = std::move(heap);
+        cap_  = 2*cap_;
+      }
+
+      (heap_ ? heap_.get() : data_)[n_++] = data;
+    }
+
+   private:
+    POINT                   point_;      // point (as first added)
+    int64_t                 kx_, ky_;    // snapped key
+    uint                    n_   { 0 };  // number of data items
+    uint                    cap_ { N };  // data item capacity
+    DATA                    data_[N];    // inline data items
+    std::unique_ptr<DATA[]> heap_;       // data items when more than N
+  };
+
+  typedef std::vector<Vertex> Vertices;
+
+  typedef typename Vertices::const_iterator const_iterator;
+
+ public:
+  explicit CVertexIndex(double tol=1E-6) :
+   tol_(tol), quantum_(4*tol) {
+  }
+
+  const_iterator begin() const { return vertices_.begin(); }
+  const_iterator end  () const { return vertices_.end  (); }
+
+  // get number of vertices
+  uint size() const { return uint(vertices_.size()); }
+
+  bool empty() const { return vertices_.empty(); }
+
+  // remove all vertices (keeping storage)
+  void clear() {
+    vertices_.clear();
+
+    std::fill(slots_.begin(), slots_.end(), -1);
+  }
+
+  // add data item to vertex at point (adding vertex if new)
+  void addData(const POINT &point, const DATA &data) {
+    int ind = find(point);
+
+    if (ind < 0)
+      ind = insert(point);
+
+    vertices_[uint(ind)].add(data);
+  }
+
+  bool hasData(const POINT &point) const {
+    return (find(point) >= 0);
+  }
+
+  // get vertex at point (must exist)
+  const Vertex &getData(const POINT &point) const {
+    int ind = find(point);
+
+    assert(ind >= 0);
+
+    return vertices_[uint(ind)];
+  }
+
+  // get index of vertex at (within tol of) point (-1 if none)
+  int find(const POINT &point) const {
+    if (vertices_.empty()) return -1;
+
+    double fx = point.x()/quantum_, fy = point.y()/quantum_;
+
+    int64_t kx = int64_t(std::llround(fx)), ky = int64_t(std::llround(fy));
+
+    int ind = findKey(kx, ky, point);
+    if (ind >= 0) return ind;
+
+    // point near cell edge can match vertex snapped to adjacent cell
+    double edge = 0.5 - tol_/quantum_;
+
+    double dx = fx - double(kx), dy = fy - double(ky);
+
+    int64_t kx1 = (dx > edge ? kx + 1 : (dx < -edge ? kx - 1 : kx));
+    int64_t ky1 = (dy > edge ? ky + 1 : (dy < -edge ? ky - 1 : ky));
+
+    if (kx1 != kx && (ind = findKey(kx1, ky, point)) >= 0) return ind;
+    if (ky1 != ky && (ind = findKey(kx, ky1, point)) >= 0) return ind;
+
+    if (kx1 != kx && ky1 != ky && (ind = findKey(kx1, ky1, point)) >= 0) return ind;
+
+    return -1;
+  }
+
+ private:
+  int insert(const POINT &point) {
+    // keep load factor at most 1/2
+    if (2*(vertices_.size() + 1) > slots_.size())
+      rehash(std::max(std::size_t(64), 2*slots_.size()));
+
+    int64_t kx = int64_t(std::llround(point.x()/quantum_));
+    int64_t ky = int64_t(std::llround(point.y()/quantum_));
+
+    int ind = int(vertices_.size());
+
+    vertices_.emplace_back(point, kx, ky);
+
+    insertSlot(kx, ky, ind);
+
+    return ind;
+  }
+
+  void rehash(std::size_t n) {
+    slots_.assign(n, -1);
+
+    for (std::size_t i = 0; i < vertices_.size(); ++i)
+      insertSlot(vertices_[i].kx_, vertices_[i].ky_, int(i));
+  }
+
+  void insertSlot(int64_t kx, int64_t ky, int ind) {
+    std::size_t mask = slots_.size() - 1;
+
+    std::size_t s = hash(kx, ky) & mask;
+
+    while (slots_[s] >= 0)
+      s = (s + 1) & mask;
+
+    slots_[s] = ind;
+  }
+
+  // get index of vertex in cell within tol of point (-1 if none)
+  int findKey(int64_t kx, int64_t ky, const POINT &point) const {
+    std::size_t mask = slots_.size() - 1;
+
+    for (std::size_t s = hash(kx, ky) & mask; slots_[s] >= 0; s = (s + 1) & mask) {
+      const Vertex &vertex = vertices_[uint(slots_[s])];
+
+      if (vertex.kx_ == kx && vertex.ky_ == ky &&
+          std::abs(vertex.point_.x() - point.x()) < tol_ &&
+          std::abs(vertex.point_.y() - point.y()) < tol_)
+        return slots_[s];
+    }
+
+    return -1;
+  }
+
+  static std::size_t hash(int64_t kx, int64_t ky) {
+    uint64_t h = uint64_t(kx)*0x9E3779B97F4A7C15ULL ^ uint64_t(ky)*0xC2B2AE3D27D4EB4FULL;
+
+    return std::size_t(h ^ (h >> 32));
+  }
+
+ private:
+  double           tol_;      // merge tolerance
+  double           quantum_;  // snap grid size
+  Vertices         vertices_; // vertices (in add order)
+  std::vector<int> slots_;    // hash table of vertex indices (-1 if empty)
+};
+
+#endif